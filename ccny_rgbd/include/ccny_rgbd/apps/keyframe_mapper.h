@@ -26,6 +26,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <deque>
+#include <iomanip>
 #include <ros/ros.h>
 #include <ros/publisher.h>
 #include <pcl/point_cloud.h>
@@ -34,7 +37,10 @@
 #include <pcl/filters/passthrough.h>
 #include <tf/transform_listener.h>
 #include <visualization_msgs/Marker.h>
+#include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 #include <octomap/octomap.h>
 #include <octomap/OcTree.h>
 #include <octomap/ColorOcTree.h>
@@ -42,6 +48,12 @@
 
 #include "ccny_rgbd/types.h"
 #include "ccny_rgbd/util.h"
+#include "ccny_rgbd/rgbd_frame_builder.h"
+#include "ccny_rgbd/lazy_publisher.h"
+#include "ccny_rgbd/pose_buffer.h"
+#include "ccny_rgbd/keyframe_image_store.h"
+#include "ccny_rgbd/voxel_grid_accumulator.h"
+#include "ccny_rgbd/thread_pool.h"
 #include "ccny_rgbd/GenerateGraph.h"
 #include "ccny_rgbd/SolveGraph.h"
 #include "ccny_rgbd/AddManualKeyframe.h"
@@ -49,6 +61,9 @@
 #include "ccny_rgbd/PublishKeyframes.h"
 #include "ccny_rgbd/Save.h"
 #include "ccny_rgbd/Load.h"
+#include "ccny_rgbd/KeyframeBundle.h"
+#include "ccny_rgbd/OctomapUpdate.h"
+#include "ccny_rgbd/GetOctomap.h"
 
 namespace ccny_rgbd {
 
@@ -174,6 +189,13 @@ class KeyframeMapper
       SolveGraph::Request& request,
       SolveGraph::Response& response);
     
+    /** @brief ROS callback to get a full snapshot of the live Octomap,
+     * to which the updates on the octomap_updates topic can be applied.
+     */
+    bool getOctomapSrvCallback(
+      GetOctomap::Request& request,
+      GetOctomap::Response& response);
+    
   protected:
 
     ros::NodeHandle nh_;          ///< public nodehandle
@@ -183,11 +205,72 @@ class KeyframeMapper
     
     int queue_size_;  ///< Subscription queue size
     
+    double path_rate_; ///< Max. rate (Hz) of the live path updates, 0 = unlimited
+    double map_rate_;  ///< Rate (Hz) at which live pcd map changes are published, 0 = after every keyframe
+    double octomap_rate_; ///< Rate (Hz) at which live Octomap changes are published, 0 = after every keyframe
+
+    /** @brief Whether to receive keyframe candidate bundles from the 
+     * VisualOdometry app, instead of the image streams and odometry. 
+     * The path then only contains the keyframe candidate poses.
+     */
+    bool use_keyframe_bundles_;
+    
     double max_range_;  ///< Maximum threshold for  range (in the z-coordinate of the camera frame)
     double max_stdev_;  ///< Maximum threshold for range (z-coordinate) standard deviation
 
     rgbdtools::KeyframeVector keyframes_;    ///< vector of RGBD Keyframes
     
+    /** @brief The messages backing the images of a keyframe.
+     * 
+     * Keyframes created from incoming messages reference the message 
+     * buffers instead of copying them. Holding the message pointers keeps
+     * the buffers alive. When running as a nodelet, these are the same 
+     * buffers that other nodelets in the manager see.
+     */
+    struct KeyframeMsgs
+    {
+      ImageMsg::ConstPtr rgb_msg;   ///< RGB message
+      ImageMsg::ConstPtr depth_msg; ///< Depth message
+    };
+    
+    /** @brief Message buffers for each keyframe, aligned with \ref keyframes_.
+     * Empty for keyframes which own their images (for example, loaded from disk),
+     * or whose images are compressed.
+     */
+    std::vector<KeyframeMsgs> keyframe_msgs_;
+    
+    /** @brief Whether to keep the keyframe images compressed in 
+     * \ref image_store_. The images of the keyframes are then empty, 
+     * except while they are being used.
+     */
+    bool compress_keyframes_;
+    
+    KeyframeImageStore image_store_; ///< compressed keyframe images, aligned with \ref keyframes_
+
+    boost::shared_ptr<ThreadPool> map_thread_pool_; ///< worker threads for building maps
+
+    /** @brief Whether to maintain \ref live_map_ as keyframes are added,
+     * so that the pcd map does not need to be rebuilt for every export.
+     */
+    bool use_live_map_;
+
+    /** @brief The pcd map, updated incrementally with each new keyframe. 
+     * Only valid while \ref live_map_valid_ is set.
+     */
+    VoxelGridAccumulator live_map_;
+    
+    /** @brief Whether \ref live_map_ matches the keyframes. Cleared when
+     * the keyframes are replaced, for example by loading them. Keyframes
+     * moved by solving the graph are moved in the map instead.
+     */
+    bool live_map_valid_;
+    
+    bool live_map_dirty_; ///< whether \ref live_map_ changed since it was last published
+    
+    AffineTransformVector live_map_poses_; ///< keyframe poses with which \ref live_map_ was built
+
+    boost::mutex live_map_mutex_; ///< guards \ref live_map_ and \ref live_map_valid_
+    
     /** @brief Main callback for RGB, Depth, and CameraInfo messages
      * 
      * @param depth_msg Depth message (16UC1, in mm)
@@ -198,12 +281,30 @@ class KeyframeMapper
                               const ImageMsg::ConstPtr& depth_msg,
                               const CameraInfoMsg::ConstPtr& info_msg);
 
+    /** @brief Callback for the odometry messages (usually from the
+     * VisualOdometry app) which provide the pose of the base frame.
+     * 
+     * Processes any frames which were waiting for this pose.
+     */
+    void odomCallback(const OdomMsg::ConstPtr& odom_msg);
+
+    /** @brief Callback for the keyframe candidates selected by the
+     * VisualOdometry app, used instead of the full-rate image streams
+     * when \ref use_keyframe_bundles_ is set.
+     */
+    void keyframeBundleCallback(const KeyframeBundle::ConstPtr& bundle_msg);
+
   private:
 
-    ros::Publisher keyframes_pub_;    ///< ROS publisher for the keyframe point clouds
-    ros::Publisher poses_pub_;        ///< ROS publisher for the keyframe poses
-    ros::Publisher kf_assoc_pub_;     ///< ROS publisher for the keyframe associations
-    ros::Publisher path_pub_;         ///< ROS publisher for the keyframe path
+    LazyPublisher keyframes_pub_;     ///< ROS publisher for the keyframe point clouds
+    LazyPublisher poses_pub_;         ///< ROS publisher for the keyframe poses
+    LazyPublisher kf_assoc_pub_;      ///< ROS publisher for the keyframe associations
+    LazyPublisher path_pub_;          ///< ROS publisher for the keyframe path
+    LazyPublisher map_pub_;           ///< ROS publisher for the live pcd map
+    LazyPublisher octomap_updates_pub_; ///< ROS publisher for the live Octomap changes
+    
+    ros::Timer map_timer_;     ///< ROS timer for publishing the live pcd map
+    ros::Timer octomap_timer_; ///< ROS timer for publishing the live Octomap changes
     
     /** @brief ROS service to generate the graph correpondences */
     ros::ServiceServer generate_graph_service_;
@@ -231,6 +332,9 @@ class KeyframeMapper
     
     /** @brief ROS service to add a manual keyframe */
     ros::ServiceServer add_manual_keyframe_service_;
+    
+    /** @brief ROS service to get the live Octomap */
+    ros::ServiceServer get_octomap_service_;
 
     tf::TransformListener tf_listener_; ///< ROS transform listener
 
@@ -243,6 +347,12 @@ class KeyframeMapper
     /** @brief Callback syncronizer */
     boost::shared_ptr<RGBDSynchronizer3> sync_;
           
+    /** @brief Odometry message subscriber */
+    ros::Subscriber odom_sub_;
+
+    /** @brief Keyframe bundle subscriber */
+    ros::Subscriber bundle_sub_;
+
     /** @brief RGB message subscriber */
     ImageSubFilter      sub_rgb_;
     
@@ -258,13 +368,60 @@ class KeyframeMapper
     double kf_dist_eps_;  ///< linear distance threshold between keyframes
     double kf_angle_eps_; ///< angular distance threshold between keyframes
     bool octomap_with_color_; ///< whetehr to save Octomaps with color info      
+    double octomap_max_range_; ///< rays are truncated beyond this range (-1 = unlimited)
+    bool octomap_lazy_eval_;   ///< update the inner Octomap nodes only once, after all the scans
+    bool octomap_parallel_;    ///< ray cast the Octomap scans on \ref map_thread_pool_
+    
+    /** @brief Whether to maintain a live Octomap (\ref live_octree_ or 
+     * \ref live_color_octree_, depending on \ref octomap_with_color_), 
+     * updated with each new keyframe.
+     */
+    bool use_live_octomap_;
+    
+    boost::shared_ptr<octomap::OcTree> live_octree_;            ///< live Octomap, without color
+    boost::shared_ptr<octomap::ColorOcTree> live_color_octree_; ///< live Octomap, with color
+    bool live_octomap_reset_;         ///< whether the live Octomap was rebuilt since the last update
+    octomap::KeySet live_octomap_changes_; ///< leaves of the live Octomap touched since the last update
+    AffineTransformVector live_octomap_poses_; ///< keyframe poses with which the live Octomap was built
+    
+    double reintegration_dist_eps_;  ///< keyframes which moved more than this are moved in the live maps
+    double reintegration_angle_eps_; ///< keyframes which turned more than this are moved in the live maps
+    boost::mutex live_octomap_mutex_; ///< guards the live Octomap
     double max_map_z_;   ///< maximum z (in fixed frame) when exporting maps.
+    int map_threads_;    ///< worker threads for building maps (-1: one per core)
           
     // state vars
     bool manual_add_;   ///< flag indicating whetehr a manual add has been requested
 
     int rgbd_frame_index_;
 
+    RGBDFrameBuilder frame_builder_; ///< builds pooled RGBD frames from the incoming messages
+
+    /** @brief Messages of an RGBD frame waiting for its pose
+     */
+    struct PendingFrame
+    {
+      ImageMsg::ConstPtr rgb_msg;        ///< RGB message
+      ImageMsg::ConstPtr depth_msg;      ///< Depth message
+      CameraInfoMsg::ConstPtr info_msg;  ///< CameraInfo message
+    };
+
+    PoseBuffer pose_buffer_;   ///< fixed to base poses, from the odometry messages
+    
+    /** @brief Frames which arrived before the odometry covering their 
+     * time stamp, oldest first. Bounded by \ref pending_queue_size_.
+     */
+    std::deque<PendingFrame> pending_frames_;
+    int pending_queue_size_;   ///< Max. number of frames waiting for a pose
+    int n_dropped_frames_;     ///< Number of frames dropped without a pose
+    
+    boost::mutex frames_mutex_; ///< guards the pending frames and the frame processing
+
+    std::string base_frame_;   ///< the base frame of the odometry messages
+    std::string odom_child_frame_; ///< the frame of the buffered odometry poses
+    bool has_b2c_;             ///< whether b2c_ has been received
+    tf::Transform b2c_;        ///< Transform from the base to the camera frame, wrt base frame
+
     rgbdtools::KeyframeGraphDetector graph_detector_;  ///< builds graph from the keyframes
     rgbdtools::KeyframeGraphSolverG2O graph_solver_;    ///< optimizes the graph for global alignement
 
@@ -272,22 +429,100 @@ class KeyframeMapper
     
     PathMsg path_msg_;    /// < contains a vector of positions of the camera (not base) pose
     
-    /** @brief processes an incoming RGBD frame with a given pose,
-     * and determines whether a keyframe should be inserted
-     * @param frame the incoming RGBD frame (image)
-     * @param pose the pose of the base frame when RGBD image was taken
-     * @retval true a keyframe was inserted
-     * @retval false no keyframe was inserted
+    /** @brief Processes the pending frames, in order, until reaching 
+     * a frame whose pose is not available yet. Frames older than the
+     * pose buffer are dropped. The caller must hold \ref frames_mutex_.
+     */
+    void processPendingFrames();
+    
+    /** @brief Looks up the pose of the camera at the time of a message,
+     * without blocking.
+     * 
+     * @param header the header of the RGB message
+     * @param f2c the fixed to camera transform
+     * @return the result of the lookup in the pose buffer. NOT_AVAILABLE
+     *         is also returned while the base to camera transform is missing.
+     */
+    PoseBuffer::LookupResult getCameraPose(
+      const std_msgs::Header& header, tf::Transform& f2c);
+    
+    /** @brief Processes the messages of a frame. The RGBD frame is only
+     * built from the messages if it becomes a keyframe.
+     * @param pending the frame messages
+     * @param f2c the fixed to camera transform at the time of the frame
      */
-    bool processFrame(const rgbdtools::RGBDFrame& frame, const AffineTransform& pose);
+    void processMessages(const PendingFrame& pending, const tf::Transform& f2c);
+    
+    /** @brief processes the pose of an incoming RGBD frame: adds it to 
+     * the path, and determines whether a keyframe should be inserted.
+     * 
+     * Only the pose is needed, so that the images of frames which are
+     * not inserted never have to be converted.
+     * 
+     * @param header the header of the incoming RGBD frame
+     * @param pose the pose of the camera when RGBD image was taken
+     * @retval true a keyframe should be inserted
+     * @retval false no keyframe should be inserted
+     */
+    bool processFrame(const std_msgs::Header& header, const AffineTransform& pose);
     
     /** @brief creates a keyframe from an RGBD frame and inserts it in
      * the keyframe vector.
+     * 
+     * The keyframe shares the image buffers of the frame. The caller is
+     * responsible for keeping them alive (see \ref keyframe_msgs_).
+     * 
      * @param frame the incoming RGBD frame (image)
      * @param pose the pose of the base frame when RGBD image was taken
      */
     void addKeyframe(const rgbdtools::RGBDFrame& frame, const AffineTransform& pose);
 
+    /** @brief Compresses the images of a keyframe into \ref image_store_,
+     * and releases them from the keyframe. Keyframes must be compressed
+     * in order of their index.
+     * @param i the keyframe index
+     */
+    void compressKeyframeImages(int i);
+    
+    /** @brief Restores the images of a compressed keyframe, through the
+     * decoding cache of \ref image_store_.
+     * @param i the keyframe index
+     * @retval true the images were restored, and should be released 
+     *         with \ref releaseKeyframeImages after use
+     * @retval false nothing to do (no compression, or images present)
+     */
+    bool decompressKeyframeImages(int i);
+    
+    /** @brief Releases the (decompressed) images of a keyframe
+     * @param i the keyframe index
+     */
+    void releaseKeyframeImages(int i);
+    
+    /** @brief Restores the images of all the compressed keyframes
+     * @param decompressed whether the images of each keyframe were restored
+     */
+    void decompressAllKeyframeImages(std::vector<bool>& decompressed);
+
+    /** @brief Releases the images restored by \ref decompressAllKeyframeImages
+     * @param decompressed whether the images of each keyframe were restored
+     */
+    void releaseAllKeyframeImages(const std::vector<bool>& decompressed);
+    
+    /** @brief Saves the keyframes like rgbdtools::saveKeyframes, but 
+     * restores the images of only one compressed keyframe at a time
+     * @param path the keyframes directory
+     * @retval true the keyframes were saved
+     */
+    bool saveAllKeyframes(const std::string& path);
+    
+    /** @brief Appends the keyframes saved in a directory, like 
+     * rgbdtools::loadKeyframes, compressing the images of each keyframe 
+     * as soon as it is loaded
+     * @param path the keyframes directory
+     * @retval true the keyframes were loaded
+     */
+    bool loadAllKeyframes(const std::string& path);
+    
     /** @brief Publishes the point cloud associated with a keyframe
      * @param i the keyframe index
      */
@@ -321,6 +556,81 @@ class KeyframeMapper
      * @param map_cloud the point cloud to be built
      */
     void buildPcdMap(PointCloudT& map_cloud);
+
+    /** @brief Adds a range of keyframes to a voxel grid. Called in 
+     * parallel by \ref buildPcdMap, one call per range.
+     * @param chunk index of the range
+     * @param chunk_size number of keyframes per range
+     * @param grids the voxel grids, one per range
+     */
+    void buildPcdMapChunk(int chunk, int chunk_size,
+                          std::vector<VoxelGridAccumulator>* grids);
+
+    /** @brief Adds a new keyframe to \ref live_map_. The keyframe 
+     * images must be available.
+     * @param i the keyframe index
+     */
+    void updateLiveMap(int i);
+
+    /** @brief Marks \ref live_map_ as outdated. It is rebuilt from all 
+     * the keyframes the next time the pcd map is needed.
+     */
+    void invalidateLiveMap();
+
+    /** @brief Publishes the pcd map, if it changed since it was last
+     * published
+     */
+    void publishMap();
+    
+    /** @brief ROS timer callback publishing the live pcd map at
+     * \ref map_rate_
+     */
+    void mapTimerCallback(const ros::TimerEvent& event);
+    
+    /** @brief Rebuilds the live Octomap from all the keyframes, for 
+     * example after their poses changed.
+     */
+    void resetLiveOctomap();
+    
+    /** @brief Inserts a new keyframe into the live Octomap. The keyframe
+     * images must be available.
+     * @param i the keyframe index
+     */
+    void updateLiveOctomap(int i);
+    
+    /** @brief Publishes the leaves of the live Octomap which changed 
+     * since the last update, if any
+     */
+    void publishOctomapUpdate();
+    
+    /** @brief ROS timer callback publishing the live Octomap changes at
+     * \ref octomap_rate_
+     */
+    void octomapTimerCallback(const ros::TimerEvent& event);
+    
+    /** @brief Finds the keyframes which moved (for example, by solving the
+     * graph) by more than \ref reintegration_dist_eps_ or 
+     * \ref reintegration_angle_eps_ since they were added to a map
+     * @param map_poses the keyframe poses with which the map was built
+     * @param moved the indices of the keyframes which moved
+     */
+    void findMovedKeyframes(const AffineTransformVector& map_poses,
+                            std::vector<int>& moved);
+    
+    /** @brief Moves keyframes in \ref live_map_, by removing their points
+     * at the old pose and adding them at the new one
+     * @param moved the indices of the keyframes to move
+     */
+    void reintegrateLiveMap(const std::vector<int>& moved);
+    
+    /** @brief Moves keyframes in the live Octomap, by reverting their scans 
+     * at the old pose and inserting them at the new one. 
+     * 
+     * The live Octomap is not clamped, so reverting restores the 
+     * occupancy exactly (up to float rounding). Colors are not reverted.
+     * @param moved the indices of the keyframes to move
+     */
+    void reintegrateLiveOctomap(const std::vector<int>& moved);
                    
    /** @brief Save the full map to disk as octomap
      * @param path path to save the map to
@@ -334,10 +644,102 @@ class KeyframeMapper
      */
     void buildOctomap(octomap::OcTree& tree);
     
-    /** @brief Builds an octomap octree from all keyframes, with color
+    /** @brief Sum of the colors of the points falling in an octree leaf
+     */
+    struct ColorSum
+    {
+      unsigned int r, g, b; ///< sum of the colors
+      unsigned int n;       ///< number of points
+    };
+    
+    typedef boost::unordered_map<
+      octomap::OcTreeKey, ColorSum, octomap::OcTreeKey::KeyHash> ColorSumMap;
+    
+    /** @brief Cells updated by the scan of one keyframe
+     */
+    struct OctomapScanUpdate
+    {
+      OctomapScanUpdate(): keyframe(0), collect_colors(false) { }
+      
+      int keyframe;                   ///< index of the keyframe
+      bool collect_colors;            ///< whether to fill colors (color scans only)
+      octomap::KeySet free_cells;     ///< cells traversed by the rays
+      octomap::KeySet occupied_cells; ///< cells at the ray endpoints
+      ColorSumMap colors;             ///< color sums of the leaves (color scans only)
+    };
+    
+    /** @brief Builds the octomap scan of a keyframe
+     * @param i the keyframe index
+     * @param pose the keyframe pose
+     * @param scan the points, in the fixed frame
+     * @param origin the sensor origin, in the fixed frame
+     * @retval false the keyframe images are unavailable
+     */
+    bool buildOctomapScan(int i, 
+                          const AffineTransform& pose,
+                          octomap::Pointcloud& scan, 
+                          octomap::point3d& origin);
+    
+    /** @brief Builds and ray casts the scan of a keyframe. Called in 
+     * parallel by \ref buildOctomap and \ref reintegrateLiveOctomap.
+     * @param task index of the update to compute
+     * @param tree octree with the map resolution (only used for its 
+     *        key conversions)
+     * @param poses the keyframe pose of each update
+     * @param color whether to build a color scan (\ref buildColorOctomapScan)
+     * @param updates the cell updates, with the keyframe index set
+     */
+    void computeOctomapUpdate(int task, 
+                              const octomap::OcTree* tree,
+                              const AffineTransformVector* poses,
+                              bool color,
+                              std::vector<OctomapScanUpdate>* updates);
+    
+    /** @brief Ray casts a scan, like octomap::OcTree::computeUpdate, 
+     * but without using the shared ray buffers of the tree, so that 
+     * several scans can be ray cast concurrently.
+     * @param tree octree with the map resolution
+     * @param scan the points, in the fixed frame
+     * @param origin the sensor origin, in the fixed frame
+     * @param update the free and occupied cells
+     */
+    void castOctomapScan(const octomap::OcTree& tree,
+                         const octomap::Pointcloud& scan,
+                         const octomap::point3d& origin,
+                         OctomapScanUpdate& update);
+    
+    /** @brief Records the leaves touched by a scan in 
+     * \ref live_octomap_changes_, for the next Octomap update. The 
+     * live Octomap mutex must be held.
+     * @param update the free and occupied cells, and the colored leaves
+     */
+    void trackOctomapChanges(const OctomapScanUpdate& update);
+    
+    /** @brief Builds an octomap octree from all keyframes, with color.
+     * 
+     * Each leaf gets the average color of all the points which hit it.
      * @param tree reference to the octomap octree
      */
     void buildColorOctomap(octomap::ColorOcTree& tree);
+    
+    /** @brief Builds the octomap scan of a keyframe, and sums the 
+     * point colors by leaf
+     * @param i the keyframe index
+     * @param pose the keyframe pose
+     * @param tree octree with the map resolution (only used for its 
+     *        key conversions)
+     * @param scan the points, in the fixed frame
+     * @param origin the sensor origin, in the fixed frame
+     * @param colors the color sums, to which the points are added 
+     *        (NULL to skip the colors)
+     * @retval false the keyframe images are unavailable
+     */
+    bool buildColorOctomapScan(int i, 
+                               const AffineTransform& pose,
+                               const octomap::OcTree& tree,
+                               octomap::Pointcloud& scan, 
+                               octomap::point3d& origin,
+                               ColorSumMap* colors);
         
     /** @brief Convert a tf pose to octomap pose
      * @param poseTf the tf pose
@@ -34,6 +34,7 @@
 
 #include "ccny_rgbd/types.h"
 #include "ccny_rgbd/util.h"
+#include "ccny_rgbd/lazy_publisher.h"
 #include "ccny_rgbd/RGBDImageProcConfig.h"
 
 namespace ccny_rgbd {
@@ -102,7 +103,7 @@ class RGBDImageProc
     ImagePublisher rgb_publisher_;      ///< ROS rgb image publisher
     ImagePublisher depth_publisher_;    ///< ROS depth image publisher
     ros::Publisher info_publisher_;     ///< ROS camera info publisher
-    ros::Publisher cloud_publisher_;    ///< ROS PointCloud publisher
+    LazyPublisher cloud_publisher_;     ///< ROS PointCloud publisher
     
     ProcConfigServer config_server_;    ///< ROS dynamic reconfigure server
     
@@ -114,6 +115,7 @@ class RGBDImageProc
     bool verbose_;             ///< Whether to print the rectification and unwarping messages
     bool unwarp_;             ///< Whether to perform depth unwarping based on polynomial model
     bool publish_cloud_;      ///< Whether to calculate and publish the dense PointCloud
+    double cloud_rate_;       ///< Max. rate (Hz) of the dense PointCloud, 0 = unlimited
     
     /** @brief Downasampling scale (0, 1]. For example, 
      * 2.0 will result in an output image half the size of the input
@@ -25,9 +25,13 @@
 #define CCNY_RGBD_RGBD_VISUAL_ODOMETRY_H
 
 #include <ros/ros.h>
+#include <boost/thread.hpp>
+#include <deque>
+#include <boost/lexical_cast.hpp>
 #include <sensor_msgs/PointCloud2.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <visualization_msgs/Marker.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <tf/transform_listener.h>
 #include <tf/transform_broadcaster.h>
 #include <pcl_ros/point_cloud.h>
@@ -35,6 +39,17 @@
 
 #include "ccny_rgbd/types.h"
 #include "ccny_rgbd/util.h"
+#include "ccny_rgbd/vo_config.h"
+#include "ccny_rgbd/rgbd_frame_builder.h"
+#include "ccny_rgbd/motion_prior.h"
+#include "ccny_rgbd/motion_estimation_icp_prob_model_voxel.h"
+#include "ccny_rgbd/tiled_feature_detector.h"
+#include "ccny_rgbd/feature_count_controller.h"
+#include "ccny_rgbd/bounded_queue.h"
+#include "ccny_rgbd/latency_histogram.h"
+#include "ccny_rgbd/async_file_writer.h"
+#include "ccny_rgbd/lazy_publisher.h"
+#include "ccny_rgbd/KeyframeBundle.h"
 #include "ccny_rgbd/FeatureDetectorConfig.h"
 #include "ccny_rgbd/GftDetectorConfig.h"
 #include "ccny_rgbd/StarDetectorConfig.h"
@@ -50,6 +65,14 @@ namespace ccny_rgbd {
  * as well as a selection of registration algorithms. The default registration 
  * method (ICPProbModel) aligns the incoming 3D sparse features against a persistent
  * 3D feature model, which is continuously updated using a Kalman Filer.
+ *
+ * Optionally (see \ref pipeline_), frame creation and feature detection
+ * run on a worker thread, concurrently with the registration of the 
+ * previous frame on a second worker thread.
+ *
+ * For bounded pose latency, the class can also process only the newest
+ * frame (see \ref latest_frame_only_), and drop frames which are older
+ * than a latency budget (see \ref max_latency_).
  */  
 class VisualOdometry
 {
@@ -68,6 +91,24 @@ class VisualOdometry
 
   private:
 
+    /** @brief An RGBD frame travelling through the processing stages,
+     * together with its timing information
+     */
+    struct PipelineFrame
+    {
+      ImageMsg::ConstPtr rgb_msg;       ///< RGB message (8UC3)
+      ImageMsg::ConstPtr depth_msg;     ///< Depth message (16UC1 or 32FC1)
+      CameraInfoMsg::ConstPtr info_msg; ///< CameraInfo message
+
+      boost::shared_ptr<rgbdtools::RGBDFrame> frame; ///< the frame, once created
+
+      ros::WallTime start; ///< time when the messages were received
+      double d_frame;      ///< frame creation duration, in ms
+      double d_features;   ///< feature detection duration, in ms
+    };
+
+    typedef BoundedQueue<PipelineFrame> PipelineQueue;
+
     // **** ROS-related
 
     ros::NodeHandle nh_;                ///< the public nodehandle
@@ -77,16 +118,24 @@ class VisualOdometry
     ros::Publisher odom_publisher_;           ///< ROS Odometry publisher
     ros::Publisher pose_stamped_publisher_;   ///< ROS pose stamped publisher
     ros::Publisher path_pub_;                 ///< ROS publisher for the VO path
+    ros::Timer path_timer_;                   ///< ROS timer for republishing the VO path
+    LazyPublisher keyframe_bundle_publisher_; ///< ROS publisher for the keyframe candidate bundles
 
-    ros::Publisher feature_cloud_publisher_;     
-    ros::Publisher feature_cov_publisher_;  
-    ros::Publisher model_cloud_publisher_;       
-    ros::Publisher model_cov_publisher_;         
+    LazyPublisher feature_cloud_publisher_;   ///< ROS publisher for the feature cloud
+    LazyPublisher feature_cov_publisher_;     ///< ROS publisher for the feature covariances
+    LazyPublisher model_cloud_publisher_;     ///< ROS publisher for the model cloud
+    LazyPublisher model_cov_publisher_;       ///< ROS publisher for the model covariances
+             
+    ros::Publisher diagnostics_publisher_;    ///< ROS publisher for the latency statistics
+    ros::Timer diagnostics_timer_;            ///< ROS timer for publishing the latency statistics
              
-    FILE * diagnostics_file_;           ///< File for time recording statistics
+    boost::shared_ptr<AsyncFileWriter> diagnostics_writer_; ///< Background writer for time recording statistics
     std::string diagnostics_file_name_; ///< File name for time recording statistics
     bool save_diagnostics_;              ///< indicates whether to save results to file or print to screen
     bool verbose_;                      ///< indicates whether to print diagnostics to screen
+    bool publish_diagnostics_;          ///< indicates whether to publish the latency statistics
+    double diagnostics_period_;         ///< period (in seconds) for publishing the latency statistics
+    int diagnostics_window_;            ///< number of recent frames used for the latency statistics
     
     GftDetectorConfigServerPtr gft_config_server_;    ///< ROS dynamic reconfigure server for GFT params
     StarDetectorConfigServerPtr star_config_server_;  ///< ROS dynamic reconfigure server for STAR params
@@ -120,11 +169,27 @@ class VisualOdometry
     bool publish_odom_;       ///< Parameter whether to publish an odom message
     bool publish_pose_;       ///< Parameter whether to publish a pose message
 
+    bool publish_keyframe_bundles_; ///< Parameter whether to publish keyframe candidate bundles
+    double kf_dist_eps_;      ///< Linear distance threshold between keyframe candidates
+    double kf_angle_eps_;     ///< Angular distance threshold between keyframe candidates
+
+    int path_max_poses_;      ///< Max. poses kept in the path (oldest are dropped). 0 = unbounded
+    double path_min_dist_;    ///< Min. linear distance between consecutive path poses
+    double path_min_angle_;   ///< Min. angular distance between consecutive path poses
+
+    /** @brief Period (in seconds) for republishing the path. 
+     * If 0, the path is published every frame.
+     */
+    double path_period_;
+
     bool publish_feature_cloud_;
     bool publish_feature_cov_; 
 
     bool publish_model_cloud_;
     bool publish_model_cov_;    
+
+    double feature_cloud_rate_; ///< Max. rate (Hz) for the feature cloud and covariances, 0 = unlimited
+    double model_cloud_rate_;   ///< Max. rate (Hz) for the model cloud and covariances, 0 = unlimited
     
     /** @brief Feature detector type parameter
      * 
@@ -135,6 +200,15 @@ class VisualOdometry
      *  - ORB
      */
     std::string detector_type_;
+
+    int tile_rows_;     ///< Rows of the feature detection grid (tiling is off for a 1x1 grid)
+    int tile_cols_;     ///< Columns of the feature detection grid
+    int tile_overlap_;  ///< Overlap between detection tiles, in pixels
+    
+    /** @brief Worker threads for tiled detection. If negative, one less than 
+     * the number of cores (the detection thread itself works on tiles too).
+     */
+    int tile_threads_;  
     
     /** @brief Motion estimation (registration) type parameter
      * 
@@ -151,6 +225,33 @@ class VisualOdometry
     bool publish_cloud_; 
     
     int queue_size_;  ///< Subscription queue size
+
+    /** @brief If true, frame creation and feature detection run on a 
+     * worker thread, in parallel with the registration of the previous
+     * frame. Poses are still published in the order frames arrive.
+     */
+    bool pipeline_;
+
+    int pipeline_queue_size_; ///< Capacity of the queues between pipeline stages
+
+    /** @brief If true, always process the newest synchronized frame,
+     * and drop the older frames waiting to be processed.
+     */
+    bool latest_frame_only_;
+
+    /** @brief Latency budget, in seconds. Frames older than this (wrt the
+     * current time) when a processing stage starts are dropped.
+     * Disabled if <= 0.
+     */
+    double max_latency_;
+
+    /** @brief Motion prior used to seed the registration: 
+     * none, constant_velocity, or odometry
+     */
+    std::string motion_prior_type_;
+    
+    std::string motion_prior_topic_;    ///< Odometry topic for the odometry motion prior
+    double motion_prior_buffer_;        ///< Length of the odometry buffer, in seconds
     
     // **** variables
 
@@ -161,11 +262,74 @@ class VisualOdometry
     tf::Transform b2c_;  ///< Transform from the base to the camera frame, wrt base frame
     tf::Transform f2b_;  ///< Transform from the fixed to the base frame, wrt fixed frame
 
+    /** @brief The fixed to base transform, as tracked internally by the 
+     * motion estimation. Differs from f2b_ when a motion prior is used.
+     */
+    tf::Transform f2b_model_;
+
+    bool has_last_keyframe_;          ///< Whether a keyframe candidate has been published
+    tf::Transform last_keyframe_f2c_; ///< Fixed to camera transform of the last keyframe candidate
+
+    MotionPriorPtr motion_prior_; ///< predicts the pose of new frames (optional)
+
+    Vector3fVector kp_means_backup_;        ///< unseeded feature means
+    Matrix3fVector kp_covariances_backup_;  ///< unseeded feature covariances
+
+    RGBDFrameBuilder frame_builder_; ///< builds pooled RGBD frames from the incoming messages
+
     boost::shared_ptr<rgbdtools::FeatureDetector> feature_detector_; ///< The feature detector object
 
-    rgbdtools::MotionEstimationICPProbModel motion_estimation_; ///< The motion estimation object
+    boost::shared_ptr<ThreadPool> thread_pool_; ///< Worker threads for tiled detection
+    boost::shared_ptr<TiledFeatureDetector> tiled_detector_; ///< Tiled detection (optional)
+
+    /** @brief Adapts the detector parameters to a per-frame time budget
+     * (optional). Guarded by detector_mutex_.
+     */
+    FeatureCountController feature_controller_;
+
+    /** @brief The nearest neighbor index of the ICPProbModel model:
+     * kdtree (rgbdtools, rebuilt every frame) or voxel_hash (incremental)
+     */
+    std::string model_index_type_;
+
+    boost::shared_ptr<rgbdtools::MotionEstimation> motion_estimation_; ///< The motion estimation object
+    boost::shared_ptr<rgbdtools::MotionEstimationICPProbModel> icp_kdtree_; ///< motion_estimation_, if kdtree
+    boost::shared_ptr<MotionEstimationICPProbModelVoxel> icp_voxel_;        ///< motion_estimation_, if voxel_hash
   
-    PathMsg path_msg_; ///< contains a vector of positions of the Base frame.
+    /** @brief Compact path pose, appended every frame
+     */
+    struct PathPose
+    {
+      ros::Time stamp;
+      float x, y, z;
+      float qx, qy, qz, qw;
+    };
+
+    std::deque<PathPose> path_poses_; ///< the (decimated, bounded) path of the Base frame
+    boost::mutex path_mutex_;         ///< guards path_poses_
+    tf::Transform last_path_pose_;    ///< the last pose added to the path
+    
+    PathMsg path_msg_; ///< the path message, reused between publications
+
+    boost::mutex detector_mutex_; ///< guards the feature detector against reconfiguration
+
+    boost::shared_ptr<PipelineQueue> input_queue_;   ///< received messages, waiting for detection
+    boost::shared_ptr<PipelineQueue> feature_queue_; ///< frames with features, waiting for registration
+
+    boost::thread detection_thread_;    ///< pipeline worker: frame creation and detection
+    boost::thread registration_thread_; ///< pipeline worker: registration and publishing
+
+    int n_dropped_frames_;      ///< number of frames dropped by the scheduling
+    boost::mutex drop_mutex_;   ///< guards the dropped frames counter
+
+    boost::mutex stats_mutex_;           ///< guards the latency statistics
+    LatencyHistogram hist_frame_;        ///< frame creation durations
+    LatencyHistogram hist_features_;     ///< feature detection durations
+    LatencyHistogram hist_reg_;          ///< registration durations
+    LatencyHistogram hist_publish_;      ///< output publishing durations
+    LatencyHistogram hist_total_;        ///< total durations, from message reception
+    int stats_frame_count_;              ///< frame count, for the published statistics
+    int stats_n_model_pts_;              ///< model size, for the published statistics
 
     // **** private functions
     
@@ -179,6 +343,47 @@ class VisualOdometry
                       const ImageMsg::ConstPtr& depth_msg,
                       const CameraInfoMsg::ConstPtr& info_msg);
 
+    /** @brief Creates the RGBD frame from the messages, and detects
+     * the features in it (first pipeline stage)
+     * @param pf the frame to process
+     */
+    void createFrameAndFeatures(PipelineFrame& pf);
+
+    /** @brief Registers the frame against the model, publishes the 
+     * outputs and diagnostics (second pipeline stage)
+     * @param pf the frame to process
+     */
+    void registerAndPublish(PipelineFrame& pf);
+
+    /** @brief Pipeline worker loop for the first stage. When not 
+     * pipelined, (in latest-frame-only mode), also performs the second stage.
+     */
+    void detectionThread();
+
+    /** @brief Pipeline worker loop for the second stage
+     */
+    void registrationThread();
+
+    /** @brief Appends a frame to a pipeline queue, according to the 
+     * scheduling mode (blocking, or replacing older frames)
+     * @param queue the queue
+     * @param pf the frame
+     * @retval false the queue has been shut down
+     */
+    bool schedule(PipelineQueue& queue, const PipelineFrame& pf);
+
+    /** @brief Checks whether a frame exceeds the latency budget. 
+     * Stale frames are counted as dropped.
+     * @param pf the frame to check
+     * @retval true the frame should be dropped
+     */
+    bool isStale(const PipelineFrame& pf);
+
+    /** @brief Increases the dropped frames counter
+     * @param n number of dropped frames
+     */
+    void countDroppedFrames(int n);
+
     /** @brief Initializes all the parameters from the ROS param server
      */
     void initParams();
@@ -186,6 +391,19 @@ class VisualOdometry
     /** @brief Re-instantiates the feature detector based on the detector type parameter
      */
     void resetDetector();
+
+    /** @brief Creates the per-tile detectors, if tiled detection is enabled
+     */
+    template <class DetectorType>
+    void createTileDetectors()
+    {
+      if (!tiled_detector_) return;
+      
+      std::vector<rgbdtools::FeatureDetectorPtr> detectors;
+      for (int idx = 0; idx < tiled_detector_->getNumTiles(); ++idx)
+        detectors.push_back(boost::make_shared<DetectorType>());
+      tiled_detector_->setDetectors(detectors);
+    }
     
     /** @brief publishes the f2b_ (fixed-to-base) transform as a tf
      * @param header header of the incoming message, used to stamp things correctly
@@ -203,10 +421,29 @@ class VisualOdometry
     */
     void publishPoseStamped(const std_msgs::Header& header); 
 
+    /** @brief publishes the images and camera pose of a frame as a 
+     * keyframe candidate, if the camera moved far enough since the 
+     * last candidate. 
+     * 
+     * Lets the keyframe mapper receive only the images it needs, instead 
+     * of the full-rate image streams.
+     * 
+     * @param pf the registered frame
+     */
+    void publishKeyframeBundle(const PipelineFrame& pf);
+
     /** @brief publishes the path of f2b_ (fixed-to-base) transform as an Path message
      * @param header header of the incoming message, used to stamp things correctly
      */
     void publishPath(const std_msgs::Header& header);
+
+    /** @brief republishes the path periodically, when path_period_ > 0
+     */
+    void pathTimerCallback(const ros::TimerEvent& event);
+
+    /** @brief builds the path message from path_poses_ and publishes it
+     */
+    void publishPathMsg();
     
     /** @brief Publish the feature point cloud
      * 
@@ -221,7 +458,13 @@ class VisualOdometry
     void publishModelCovariances();
 
     /** @brief Caches the transform from the base frame to the camera frame
+     * 
+     * Does not wait for the transform: returns false immediately if it
+     * has not been received yet.
+     * 
      * @param header header of the incoming message, used to stamp things correctly
+     * @retval true the transform was cached in b2c_
+     * @retval false the transform is not available yet
      */
     bool getBaseToCameraTf(const std_msgs::Header& header);
     
@@ -241,15 +484,66 @@ class VisualOdometry
      */
     void orbReconfigCallback(OrbDetectorConfig& config, uint32_t level);
 
+    /** @brief Reads the parameters of the feature count controller
+     */
+    void configureFeatureController();
+
+    /** @brief Applies the feature count and threshold from the 
+     * feature count controller to the detector(s). 
+     * Must be called with detector_mutex_ held.
+     */
+    void applyFeatureController();
+
     /**
-     * @brief Saves computed running times to file (or print on screen)
-     * @return 1 if write to file was successful
+     * @brief Updates the latency statistics, and saves computed running 
+     * times to file (or print on screen)
      */
     void diagnostics(
-      int n_features, int n_valid_features, int n_model_pts,
-      double d_frame, double d_features, double d_reg, double d_total);
+      int n_features, int n_valid_features, int n_model_pts, int n_dropped,
+      double d_frame, double d_features, double d_reg, double d_publish, 
+      double d_total);
+
+    /** @brief Publishes the percentiles of the latency statistics as 
+     * a DiagnosticArray message
+     */
+    void diagnosticsTimerCallback(const ros::TimerEvent& event);
+
+    /** @brief Adds the percentiles of a stage's latency statistics to a
+     * diagnostic status message
+     * @param name the name of the stage
+     * @param hist the latency statistics of the stage
+     * @param status the status message
+     */
+    void addStageDiagnostics(
+      const std::string& name,
+      const LatencyHistogram& hist,
+      diagnostic_msgs::DiagnosticStatus& status);
       
     void configureMotionEstimation();
+
+    /** @brief Creates the motion prior, according to motion_prior_type_
+     */
+    void createMotionPrior();
+
+    /** @brief Seeds the registration with a predicted pose.
+     * 
+     * The motion estimation starts the ICP from its own, internal estimate
+     * of the pose (f2b_model_). The feature distributions of the frame are 
+     * moved so that, when transformed by the internal estimate, they land
+     * where the predicted pose puts them. The registration correction then
+     * applies on top of the prediction.
+     * 
+     * @param frame the frame to be registered
+     * @param f2b_pred the predicted fixed-to-base transform
+     */
+    void seedRegistration(
+      rgbdtools::RGBDFrame& frame, 
+      const tf::Transform& f2b_pred);
+
+    /** @brief Restores the feature distributions changed by
+     * seedRegistration
+     */
+    void unseedRegistration(rgbdtools::RGBDFrame& frame);
 };
 
 } // namespace ccny_rgbd
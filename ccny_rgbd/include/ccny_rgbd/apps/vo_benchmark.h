@@ -0,0 +1,242 @@
+/**
+ *  @file vo_benchmark.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_VO_BENCHMARK_H
+#define CCNY_RGBD_VO_BENCHMARK_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <rgbdtools/rgbdtools.h>
+
+#include "ccny_rgbd/types.h"
+#include "ccny_rgbd/util.h"
+#include "ccny_rgbd/vo_config.h"
+#include "ccny_rgbd/motion_estimation_icp_prob_model_voxel.h"
+#include "ccny_rgbd/latency_histogram.h"
+
+namespace ccny_rgbd {
+
+/** @brief Parameter source built from "name:=value" command line 
+ * arguments.
+ * 
+ * Mirrors the ros::NodeHandle::getParam interface, so the same 
+ * configuration code (see vo_config.h) can be used without a ROS master.
+ * A leading underscore (as in private ROS remappings) is ignored.
+ */
+class ArgParams
+{
+  public:
+
+    /** @brief Parses all "name:=value" arguments. Other arguments are
+     * ignored.
+     */
+    ArgParams(int argc, char** argv);
+
+    bool getParam(const std::string& name, std::string& value) const;
+    bool getParam(const std::string& name, double& value) const;
+    bool getParam(const std::string& name, int& value) const;
+    bool getParam(const std::string& name, bool& value) const;
+
+  private:
+
+    std::map<std::string, std::string> params_; ///< name to value map
+
+    template <typename T>
+    bool getNumeric(const std::string& name, T& value) const
+    {
+      std::string str;
+      if (!getParam(name, str)) return false;
+      try
+      {
+        value = boost::lexical_cast<T>(str);
+      }
+      catch(const boost::bad_lexical_cast&)
+      {
+        ROS_WARN("Invalid value for parameter %s: %s", 
+          name.c_str(), str.c_str());
+        return false;
+      }
+      return true;
+    }
+};
+
+/** @brief Stamped pose, as read from (or written to) a TUM-format 
+ * trajectory file
+ */
+struct StampedPose
+{
+  double stamp;          ///< time stamp, in seconds
+  AffineTransform pose;  ///< fixed frame to camera pose
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::vector<StampedPose, Eigen::aligned_allocator<StampedPose> > 
+  StampedPoseVector;
+
+/** @brief Headless visual odometry benchmark over TUM-format RGB-D 
+ * sequences
+ * 
+ * Reads the rgb.txt, depth.txt and (optionally) groundtruth.txt lists
+ * of a TUM RGB-D dataset directory, builds rgbdtools::RGBDFrame's directly
+ * from the image files, and runs them through the same feature detector and
+ * ICPProbModel motion estimation as VisualOdometry, as fast as possible.
+ * 
+ * Reports the throughput, per-stage timing percentiles, and the absolute
+ * trajectory error (ATE) and relative pose error (RPE) against ground truth. 
+ * The estimated trajectory is saved in TUM format.
+ */
+class VOBenchmark
+{
+  public:
+
+    /** @brief Constructor from a parameter source
+     * @param params the benchmark, feature and registration parameters
+     */
+    VOBenchmark(const ArgParams& params);
+
+    /** @brief Default destructor
+     */
+    virtual ~VOBenchmark();
+
+    /** @brief Runs the benchmark over the whole sequence and prints
+     * the report
+     * @retval true the sequence was processed successfully
+     * @retval false the dataset could not be read
+     */
+    bool run();
+
+  private:
+
+    /** @brief Image pair from the TUM association of rgb.txt and depth.txt
+     */
+    struct ImagePair
+    {
+      double stamp;           ///< rgb image time stamp, in seconds
+      std::string rgb_file;   ///< path to the rgb image
+      std::string depth_file; ///< path to the depth image
+    };
+
+    // **** params
+
+    std::string dataset_path_;  ///< path to the TUM dataset directory
+    std::string output_file_;   ///< path to the output trajectory file
+    std::string detector_type_; ///< GFT, STAR, ORB
+    
+    double max_time_diff_;      ///< max. stamp difference for associations [s]
+    double depth_factor_;       ///< depth image units per meter
+    int max_frames_;            ///< stop after this many frames (0 = all)
+    
+    double fx_, fy_, cx_, cy_;  ///< camera intrinsics
+
+    // **** state
+
+    rgbdtools::FeatureDetectorPtr feature_detector_; ///< the feature detector
+    std::string model_index_type_; ///< kdtree or voxel_hash
+
+    boost::shared_ptr<rgbdtools::MotionEstimation> motion_estimation_; ///< the motion estimation
+
+    LatencyHistogram hist_load_;     ///< image loading and frame creation [ms]
+    LatencyHistogram hist_features_; ///< feature extraction [ms]
+    LatencyHistogram hist_reg_;      ///< registration [ms]
+    LatencyHistogram hist_total_;    ///< total per-frame [ms]
+
+    /** @brief Creates and configures the feature detector 
+     */
+    void createFeatureDetector(const ArgParams& params);
+
+    /** @brief Creates and configures the motion estimation
+     */
+    void createMotionEstimation(const ArgParams& params);
+
+    /** @brief Reads a TUM file list (rgb.txt or depth.txt)
+     */
+    bool readFileList(
+      const std::string& filename,
+      std::vector<std::pair<double, std::string> >& list) const;
+
+    /** @brief Reads the TUM ground truth file (groundtruth.txt)
+     */
+    bool readTrajectory(
+      const std::string& filename,
+      StampedPoseVector& trajectory) const;
+
+    /** @brief Associates rgb and depth images by their closest stamps
+     */
+    void associate(
+      const std::vector<std::pair<double, std::string> >& rgb_list,
+      const std::vector<std::pair<double, std::string> >& depth_list,
+      std::vector<ImagePair>& pairs) const;
+
+    /** @brief Loads the images of an ImagePair and creates the RGBDFrame
+     * @retval false the images could not be loaded
+     */
+    bool createFrame(
+      const ImagePair& pair, 
+      int index, 
+      rgbdtools::RGBDFrame& frame) const;
+
+    /** @brief Writes the trajectory in TUM format 
+     * (# stamp x y z qx qy qz qw)
+     */
+    bool saveTrajectory(
+      const std::string& filename,
+      const StampedPoseVector& trajectory) const;
+
+    /** @brief Computes the absolute trajectory error (RMSE, in meters),
+     * after aligning the estimated trajectory to the ground truth.
+     * @return the number of associated poses
+     */
+    int computeATE(
+      const StampedPoseVector& estimate,
+      const StampedPoseVector& groundtruth,
+      double& ate_rmse) const;
+
+    /** @brief Computes the relative pose error between consecutive
+     * frames (translational RMSE in meters, rotational RMSE in degrees)
+     * @return the number of relative pose pairs
+     */
+    int computeRPE(
+      const StampedPoseVector& estimate,
+      const StampedPoseVector& groundtruth,
+      double& rpe_trans_rmse, 
+      double& rpe_rot_rmse) const;
+
+    /** @brief Finds the ground truth pose closest in time to a stamp
+     * @retval false no pose within max_time_diff_ was found
+     */
+    bool findClosest(
+      const StampedPoseVector& trajectory,
+      double stamp,
+      AffineTransform& pose) const;
+
+    /** @brief Prints the percentiles of a timing histogram
+     */
+    void printStage(const std::string& name, const LatencyHistogram& hist) const;
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_VO_BENCHMARK_H
@@ -0,0 +1,80 @@
+/**
+ *  @file async_file_writer.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_ASYNC_FILE_WRITER_H
+#define CCNY_RGBD_ASYNC_FILE_WRITER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace ccny_rgbd {
+
+/** @brief Writes lines of text to a file from a background thread.
+ * 
+ * write() only appends the line to an in-memory buffer, so it can be
+ * called from time-critical code. The background thread periodically 
+ * swaps the buffer out and writes it to disk in one go.
+ */
+class AsyncFileWriter
+{
+  public:
+
+    /** @brief Constructor. Opens (and truncates) the file.
+     * @param filename path to the file
+     */
+    explicit AsyncFileWriter(const std::string& filename);
+
+    /** @brief Destructor. Writes out any pending lines and closes the file.
+     */
+    virtual ~AsyncFileWriter();
+
+    /** @brief Whether the file was opened successfully
+     */
+    bool isOpen() const { return file_ != NULL; }
+
+    /** @brief Queues a line for writing. A newline is appended.
+     * @param line the text to write
+     */
+    void write(const std::string& line);
+
+  private:
+
+    FILE * file_;   ///< the output file
+
+    std::vector<std::string> pending_;  ///< lines waiting to be written
+    bool shutdown_;                     ///< whether the writer thread should exit
+
+    boost::mutex mutex_;                 ///< guards pending_ and shutdown_
+    boost::condition_variable cond_;     ///< signals shutdown
+    boost::thread thread_;               ///< the writer thread
+
+    /** @brief Writer thread loop
+     */
+    void writerThread();
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_ASYNC_FILE_WRITER_H
@@ -0,0 +1,151 @@
+/**
+ *  @file bounded_queue.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_BOUNDED_QUEUE_H
+#define CCNY_RGBD_BOUNDED_QUEUE_H
+
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace ccny_rgbd {
+
+/** @brief Thread-safe FIFO queue with a fixed capacity.
+ *
+ * Used to connect the stages of a processing pipeline. Producers
+ * block while the queue is full (or, with pushDropOldest(), discard 
+ * the oldest items), consumers block while it is empty.
+ * Calling shutdown() wakes up all waiting threads.
+ */
+template <typename T>
+class BoundedQueue
+{
+  public:
+
+    /** @brief Constructor
+     * @param capacity maximum number of items held by the queue
+     */
+    explicit BoundedQueue(size_t capacity):
+      capacity_(capacity > 0 ? capacity : 1),
+      shutdown_(false)
+    {
+
+    }
+
+    /** @brief Appends an item, blocking while the queue is full
+     * @param item the item to append
+     * @retval true the item was appended
+     * @retval false the queue has been shut down
+     */
+    bool push(const T& item)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (queue_.size() >= capacity_ && !shutdown_)
+        not_full_.wait(lock);
+
+      if (shutdown_) return false;
+
+      queue_.push_back(item);
+      not_empty_.notify_one();
+      return true;
+    }
+
+    /** @brief Appends an item without blocking. If the queue is full,
+     * the oldest items are discarded to make room for it.
+     * @param item the item to append
+     * @return the number of discarded items
+     */
+    int pushDropOldest(const T& item)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (shutdown_) return 0;
+
+      int n_dropped = 0;
+      while (queue_.size() >= capacity_)
+      {
+        queue_.pop_front();
+        ++n_dropped;
+      }
+
+      queue_.push_back(item);
+      not_empty_.notify_one();
+      return n_dropped;
+    }
+
+    /** @brief Removes the oldest item, blocking while the queue is empty
+     * @param item reference to the removed item
+     * @retval true an item was removed
+     * @retval false the queue has been shut down
+     */
+    bool pop(T& item)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (queue_.empty() && !shutdown_)
+        not_empty_.wait(lock);
+
+      if (shutdown_) return false;
+
+      item = queue_.front();
+      queue_.pop_front();
+      not_full_.notify_one();
+      return true;
+    }
+
+    /** @brief Wakes up all waiting producers and consumers. Any subsequent
+     * push or pop calls return false immediately.
+     */
+    void shutdown()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      shutdown_ = true;
+      queue_.clear();
+      not_empty_.notify_all();
+      not_full_.notify_all();
+    }
+
+    /** @brief Returns the current number of items in the queue
+     */
+    size_t size()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return queue_.size();
+    }
+
+  private:
+
+    size_t capacity_;  ///< maximum number of items
+    bool shutdown_;    ///< whether shutdown() has been called
+
+    std::deque<T> queue_;  ///< the queued items
+
+    boost::mutex mutex_;                  ///< state mutex
+    boost::condition_variable not_empty_; ///< signalled when an item is pushed
+    boost::condition_variable not_full_;  ///< signalled when an item is popped
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_BOUNDED_QUEUE_H
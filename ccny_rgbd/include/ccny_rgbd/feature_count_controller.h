@@ -0,0 +1,113 @@
+/**
+ *  @file feature_count_controller.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_FEATURE_COUNT_CONTROLLER_H
+#define CCNY_RGBD_FEATURE_COUNT_CONTROLLER_H
+
+namespace ccny_rgbd {
+
+/** @brief Closed-loop controller for the feature detector parameters,
+ * targeting a per-frame time budget.
+ * 
+ * Detection and registration times grow roughly linearly with the 
+ * number of features, so the feature count is scaled by the ratio of 
+ * the budget to the (smoothed) measured duration, a bounded step at a 
+ * time. The feature count is never lowered while the number of valid
+ * keypoints is below a minimum, and is raised instead.
+ * 
+ * For ORB, the threshold is lowered when the detector returns fewer 
+ * keypoints than requested, and raised when over budget at the minimum
+ * feature count. For STAR, which has no feature count, the threshold 
+ * tracks the budget instead.
+ */
+class FeatureCountController
+{
+  public:
+
+    FeatureCountController();
+
+    /** @brief Sets the time budget for detection and registration, in ms.
+     * The controller is disabled if the budget is <= 0.
+     */
+    void setBudget(double budget);
+
+    void setFeatureCountRange(int min_features, int max_features);
+    void setThresholdRange(double min_threshold, double max_threshold);
+    
+    /** @brief Sets the minimum number of valid keypoints
+     */
+    void setMinValid(int min_valid);
+    
+    /** @brief Sets the smoothing factor for the measured durations,
+     * in (0, 1]. Higher values react faster.
+     */
+    void setSmoothing(double alpha);
+
+    /** @brief Sets which of the parameters are controlled
+     */
+    void setControlled(bool feature_count, bool threshold);
+
+    bool isEnabled() const { return budget_ > 0.0; }
+
+    /** @brief Sets the current parameter values (for example, after they
+     * have been changed through dynamic reconfigure) and restarts the 
+     * duration smoothing.
+     */
+    void reset(int n_features, double threshold);
+
+    /** @brief Updates the controller with the measurements from a frame
+     * @param d_features the feature detection duration, in ms
+     * @param d_reg the registration duration, in ms
+     * @param n_keypoints the number of detected keypoints
+     * @param n_valid the number of valid keypoints
+     * @retval true the parameters changed
+     * @retval false the parameters are unchanged
+     */
+    bool update(double d_features, double d_reg, int n_keypoints, int n_valid);
+
+    int getFeatureCount() const { return (int)(n_features_ + 0.5); }
+    double getThreshold() const { return threshold_; }
+
+  private:
+
+    double budget_;        ///< time budget, in ms
+    int min_features_;     ///< lower bound for the feature count
+    int max_features_;     ///< upper bound for the feature count
+    double min_threshold_; ///< lower bound for the threshold
+    double max_threshold_; ///< upper bound for the threshold
+    int min_valid_;        ///< minimum number of valid keypoints
+    double alpha_;         ///< smoothing factor for the durations
+    double max_step_;      ///< maximum relative change per frame
+
+    bool control_count_;     ///< whether the feature count is controlled
+    bool control_threshold_; ///< whether the threshold is controlled
+
+    double n_features_;  ///< current feature count
+    double threshold_;   ///< current threshold
+    double d_avg_;       ///< smoothed duration, in ms
+    bool has_avg_;       ///< whether d_avg_ has been initialized
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_FEATURE_COUNT_CONTROLLER_H
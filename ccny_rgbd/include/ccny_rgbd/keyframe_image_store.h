@@ -0,0 +1,232 @@
+/**
+ *  @file keyframe_image_store.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_KEYFRAME_IMAGE_STORE_H
+#define CCNY_RGBD_KEYFRAME_IMAGE_STORE_H
+
+#include <list>
+#include <vector>
+#include <string>
+#include <sys/types.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace ccny_rgbd {
+
+/** @brief Keeps the RGB and depth images of keyframes in compressed form,
+ * and decodes them on demand through a size-bounded LRU cache.
+ *
+ * The RGB images are coded as JPEG (lossy) or PNG (lossless). 16-bit 
+ * depth images are coded as PNG with a low compression level, which is 
+ * lossless and fast to decode. Images of other types are stored raw.
+ * 
+ * Optionally, the compressed images are kept within a memory budget:
+ * when it is exceeded, the least recently used images are moved to a 
+ * spill file on disk, and read back from it when needed. Consecutive
+ * reads of increasing indices (as during map exports) trigger a 
+ * read-ahead of the following images.
+ * 
+ * The images are identified by the index returned by add(). All 
+ * methods are thread-safe.
+ */
+class KeyframeImageStore
+{
+  public:
+
+    /** @brief Constructor
+     * @param cache_size maximum number of decoded image pairs kept
+     */
+    explicit KeyframeImageStore(int cache_size = 8);
+
+    /** @brief Destructor. Closes (and removes) the spill file.
+     */
+    virtual ~KeyframeImageStore();
+
+    /** @brief Sets the maximum number of decoded image pairs kept
+     */
+    void setCacheSize(int cache_size);
+    
+    /** @brief Sets the coding of the RGB images
+     * @param lossless whether to use PNG (true) or JPEG (false)
+     * @param jpeg_quality the JPEG quality (0 to 100)
+     */
+    void setRgbCoding(bool lossless, int jpeg_quality);
+
+    /** @brief Enables spilling the compressed images to disk
+     * @param memory_budget max. size of the compressed images kept in 
+     *        memory, in bytes
+     * @param spill_dir directory in which the spill file is created. 
+     *        The file is removed when the store is destroyed.
+     * @param read_ahead number of images read ahead during sequential access
+     * @retval false the spill file could not be created
+     */
+    bool setSpill(size_t memory_budget, const std::string& spill_dir, int read_ahead);
+
+    /** @brief Compresses and stores a pair of images
+     * @param rgb the RGB image (8UC3)
+     * @param depth the depth image (16UC1, in mm)
+     * @return the index of the stored images
+     */
+    int add(const cv::Mat& rgb, const cv::Mat& depth);
+
+    /** @brief Retrieves a pair of images, decoding them if they 
+     * are not in the cache.
+     * 
+     * The returned images share their data with the cache. They stay valid
+     * after being evicted from the cache, but should not be modified.
+     * 
+     * @param index the index returned by add()
+     * @param rgb the RGB image
+     * @param depth the depth image
+     * @retval false the index is out of range, or reading from disk failed
+     */
+    bool get(int index, cv::Mat& rgb, cv::Mat& depth);
+
+    /** @brief Removes all the images
+     */
+    void clear();
+
+    /** @brief Number of stored image pairs
+     */
+    int size();
+    
+    /** @brief Total size of the compressed images, in bytes
+     */
+    size_t getCompressedBytes();
+
+    /** @brief Size of the compressed images kept in memory, in bytes
+     */
+    size_t getResidentBytes();
+
+  private:
+
+    /** @brief A compressed image
+     */
+    struct CodedImage
+    {
+      std::vector<uchar> data; ///< the coded (or raw) data, empty if spilled
+      size_t size;             ///< size of the data
+      bool raw;                ///< whether the data is uncoded
+      int rows, cols, type;    ///< size and type, for raw images
+    };
+
+    /** @brief A pair of compressed images
+     */
+    struct Entry
+    {
+      CodedImage rgb;
+      CodedImage depth;
+      
+      bool spilled;        ///< whether the data is in the spill file
+      off_t file_offset;   ///< offset of the data in the spill file
+    };
+
+    typedef boost::shared_ptr<const Entry> EntryPtr;
+
+    /** @brief A pair of decoded images in the cache
+     */
+    struct CacheEntry
+    {
+      cv::Mat rgb;
+      cv::Mat depth;
+      std::list<int>::iterator lru_it; ///< position in the LRU list
+    };
+
+    typedef boost::unordered_map<int, CacheEntry> Cache;
+
+    int cache_size_;        ///< maximum number of cache entries
+    bool rgb_lossless_;     ///< whether the RGB images are coded as PNG
+    int jpeg_quality_;      ///< the JPEG quality of the RGB images
+
+    boost::mutex mutex_;            ///< guards all the state
+    std::vector<EntryPtr> entries_; ///< compressed images, by index
+    size_t compressed_bytes_;       ///< total size of the compressed data
+
+    Cache cache_;          ///< decoded images, by index
+    std::list<int> lru_;   ///< cached indices, most recently used first
+
+    // **** disk spill
+
+    size_t memory_budget_;   ///< max. size of the resident compressed data (0 = unlimited)
+    int read_ahead_;         ///< number of images read ahead
+    int spill_fd_;           ///< spill file descriptor, -1 if not spilling
+    off_t spill_size_;       ///< current size of the spill file
+    size_t resident_bytes_;  ///< size of the compressed data in memory
+    int last_index_;         ///< index of the last get() call
+
+    /** @brief Resident entries, most recently used first */
+    std::list<int> resident_lru_;
+    
+    /** @brief Position of each resident entry in \ref resident_lru_ */
+    boost::unordered_map<int, std::list<int>::iterator> resident_its_;
+
+    void encode(const cv::Mat& image, const std::string& ext,
+                const std::vector<int>& params, CodedImage& coded);
+
+    void decode(const CodedImage& coded, cv::Mat& image);
+
+    /** @brief Pointer to the data of a coded image (NULL if empty)
+     */
+    static uchar* dataPtr(CodedImage& coded)
+    {
+      return coded.data.empty() ? NULL : &coded.data[0];
+    }
+    
+    static const uchar* dataPtr(const CodedImage& coded)
+    {
+      return coded.data.empty() ? NULL : &coded.data[0];
+    }
+
+    /** @brief Looks up decoded images in the cache, and marks them as
+     * most recently used. The caller must hold the mutex.
+     * @retval false the images are not in the cache
+     */
+    bool getCached(int index, cv::Mat& rgb, cv::Mat& depth);
+
+    /** @brief Evicts the least recently used entries until 
+     * the cache size is within the limit
+     */
+    void trimCache();
+
+    /** @brief Moves the least recently used entries to the spill file
+     * until the resident data is within the memory budget. 
+     * The caller must hold the mutex.
+     */
+    void trimResident();
+
+    /** @brief Reads the data of a spilled entry back from the spill file
+     * @retval false the read failed
+     */
+    bool readSpilled(const Entry& entry, Entry& loaded);
+
+    /** @brief Asks the OS to read the data of the given entries from
+     * the spill file in the background. The caller must hold the mutex.
+     */
+    void readAhead(int first, int last);
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_KEYFRAME_IMAGE_STORE_H
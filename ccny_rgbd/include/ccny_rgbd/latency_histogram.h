@@ -0,0 +1,74 @@
+/**
+ *  @file latency_histogram.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_LATENCY_HISTOGRAM_H
+#define CCNY_RGBD_LATENCY_HISTOGRAM_H
+
+#include <vector>
+
+namespace ccny_rgbd {
+
+/** @brief Keeps the most recent duration samples of a processing stage,
+ * and computes percentiles over them.
+ * 
+ * The window is a ring buffer, so adding a sample does not allocate.
+ * Percentiles are computed on demand, which is meant to happen at a
+ * much lower rate than adding samples.
+ */
+class LatencyHistogram
+{
+  public:
+
+    /** @brief Constructor
+     * @param window_size the number of most recent samples to keep
+     */
+    explicit LatencyHistogram(int window_size = 1000);
+
+    /** @brief Adds a sample, replacing the oldest one if the window is full
+     * @param value the sample (for example, a duration in ms)
+     */
+    void add(double value);
+
+    /** @brief Number of samples currently in the window
+     */
+    int getCount() const { return count_; }
+
+    /** @brief Computes the p50, p90, p99 and maximum values of the
+     * samples in the window. All are 0 if there are no samples.
+     */
+    void getPercentiles(
+      double& p50, double& p90, double& p99, double& max) const;
+
+  private:
+
+    std::vector<double> samples_; ///< ring buffer of samples
+    int count_;                   ///< number of valid samples
+    int next_;                    ///< ring buffer index for the next sample
+
+    /** @brief buffer for sorting, to avoid allocating in getPercentiles */
+    mutable std::vector<double> sorted_;
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_LATENCY_HISTOGRAM_H
@@ -0,0 +1,131 @@
+/**
+ *  @file lazy_publisher.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_LAZY_PUBLISHER_H
+#define CCNY_RGBD_LAZY_PUBLISHER_H
+
+#include <ros/ros.h>
+
+namespace ccny_rgbd {
+
+/** @brief Wrapper around a ros::Publisher for messages which are 
+ * expensive to construct (point clouds, markers, etc).
+ *
+ * Callers check shouldPublish() before building the message, so
+ * no work is done when nobody is subscribed to the topic. Optionally,
+ * the publishing rate can be throttled to a maximum value.
+ */
+class LazyPublisher
+{
+  public:
+
+    /** @brief Default constructor. The publisher is not advertised.
+     */
+    LazyPublisher():
+      max_rate_(0.0)
+    {
+
+    }
+
+    /** @brief Advertises the topic
+     * @param nh the node handle to advertise on
+     * @param topic the topic name
+     * @param queue_size the publisher queue size
+     * @param max_rate maximum publishing rate, in Hz. A value of 0 
+     *        (or less) disables throttling.
+     * @param latch whether the last message is latched
+     */
+    template <class M>
+    void advertise(
+      ros::NodeHandle& nh, const std::string& topic, 
+      uint32_t queue_size, double max_rate = 0.0, bool latch = false)
+    {
+      publisher_ = nh.advertise<M>(topic, queue_size, latch);
+      setMaxRate(max_rate);
+      last_publish_time_ = ros::WallTime();
+    }
+
+    /** @brief Sets the maximum publishing rate
+     * @param max_rate maximum rate, in Hz. 0 (or less) disables throttling.
+     */
+    void setMaxRate(double max_rate) 
+    { 
+      max_rate_ = max_rate;
+    }
+
+    /** @brief Whether a message should be built and published now
+     * 
+     * @retval true the topic has subscribers, and the minimum 
+     *         period since the last publish has elapsed
+     * @retval false otherwise
+     */
+    bool shouldPublish() const
+    {
+      if (!publisher_ || publisher_.getNumSubscribers() == 0) 
+        return false;
+
+      if (max_rate_ <= 0.0 || last_publish_time_.isZero()) 
+        return true;
+
+      double elapsed = (ros::WallTime::now() - last_publish_time_).toSec();
+      return elapsed >= 1.0 / max_rate_;
+    }
+
+    /** @brief Whether the topic has any subscribers, 
+     * regardless of the rate limit
+     */
+    bool hasSubscribers() const
+    {
+      return publisher_ && publisher_.getNumSubscribers() > 0;
+    }
+
+    /** @brief Publishes a message and records the publish time
+     */
+    template <class M>
+    void publish(const M& msg)
+    {
+      publisher_.publish(msg);
+      last_publish_time_ = ros::WallTime::now();
+    }
+
+    /** @brief Stops advertising the topic
+     */
+    void shutdown()
+    {
+      publisher_.shutdown();
+    }
+
+    /** @brief Access to the underlying publisher
+     */
+    ros::Publisher& get() { return publisher_; }
+
+  private:
+
+    ros::Publisher publisher_;       ///< the underlying publisher
+    double max_rate_;                ///< maximum publishing rate, in Hz
+    ros::WallTime last_publish_time_; ///< time of the last publish() call
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_LAZY_PUBLISHER_H
@@ -0,0 +1,209 @@
+/**
+ *  @file motion_estimation_icp_prob_model_voxel.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_MOTION_ESTIMATION_ICP_PROB_MODEL_VOXEL_H
+#define CCNY_RGBD_MOTION_ESTIMATION_ICP_PROB_MODEL_VOXEL_H
+
+#include <rgbdtools/rgbdtools.h>
+
+#include "ccny_rgbd/types.h"
+#include "ccny_rgbd/voxel_hash_index.h"
+
+namespace ccny_rgbd {
+
+/** @brief Motion estimation based on aligning sparse features
+ * against a persistent, dynamic model, with the model points
+ * indexed by a voxel hash.
+ * 
+ * Same algorithm and parameters as rgbdtools::MotionEstimationICPProbModel,
+ * which rebuilds a kd-tree over the whole model after every frame. Here,
+ * model insertions, replacements and Kalman updates change the index
+ * incrementally, so the cost per frame does not grow with the model size.
+ * 
+ * The voxel size is the maximum Euclidean correspondence distance, so ICP
+ * correspondences are exact. The candidates for Mahalanobis data 
+ * association are restricted to the neighboring voxels.
+ */
+class MotionEstimationICPProbModelVoxel: public rgbdtools::MotionEstimation
+{
+  public:
+
+    /** @brief Constructor
+     */
+    MotionEstimationICPProbModelVoxel();
+    
+    /** @brief Default destructor
+     */    
+    virtual ~MotionEstimationICPProbModelVoxel();
+
+    /** @brief Main method for estimating the motion given an RGBD frame
+     * @param frame the current RGBD frame
+     * @param prediction the predicted motion (currently ignored)
+     * @param motion the (output) incremental motion, wrt the fixed frame
+     * @retval true the motion estimation was successful
+     * @retval false the motion estimation failed
+     */
+    bool getMotionEstimationImpl(
+      rgbdtools::RGBDFrame& frame,
+      const AffineTransform& prediction,
+      AffineTransform& motion);
+  
+    /** @brief Returns the number of points in the model built from the feature buffer
+     */
+    int getModelSize() const { return model_size_; }
+
+    PointCloudFeature::Ptr getModel() { return model_ptr_; }
+    Vector3fVector* getMeans() { return &means_; }
+    Matrix3fVector* getCovariances() { return &covariances_; }
+
+    void setMaxIterations(int max_iterations);
+    void setMinCorrespondences(int min_correspondences);
+    void setNNearestNeighbors(int n_nearest_neighbors);
+    void setMaxModelSize(int max_model_size);
+    void setTfEpsilonLinear(double tf_epsilon_linear);
+    void setTfEpsilonAngular(double tf_epsilon_angular);
+    void setMaxAssociationDistMahalanobis(double max_assoc_dist_mah);
+    void setMaxCorrespondenceDistEuclidean(double max_corresp_dist_eucl);
+    
+  private:
+
+    // **** params
+
+    int max_iterations_;        ///< Maximum number of ICP iterations
+    int min_correspondences_;   ///< Minimum number of correspondences for ICP to contuinue
+    
+    /** @brief How many euclidean neighbors to go through, in a brute force
+     * search of the closest Mahalanobis neighbor.
+     */
+    int n_nearest_neighbors_; 
+    
+    /** @brief Upper bound for how many features to store in the model.
+     * 
+     * New features added beyond thi spoint will overwrite old features
+     */
+    int max_model_size_;
+
+    double tf_epsilon_linear_;     ///< Linear convergence criteria for ICP
+    double tf_epsilon_angular_;    ///< Angular convergence criteria for ICP
+
+    /** @brief Maximum Mahalanobis distance for associating points
+     * between the data and the model
+     */
+    double max_assoc_dist_mah_;    
+    
+    /** @brief Maximum Euclidean correspondce distance for ICP,
+     * also the voxel size of the model index
+     */
+    double max_corresp_dist_eucl_; 
+    
+    /** @brief Maximum squared Mahalanobis distance for associating points
+     * between the data and the model, derived.
+     */
+    double max_assoc_dist_mah_sq_;    
+    
+    /** @brief Maximum Euclidean correspondce distance for ICP, derived
+     */
+    double max_corresp_dist_eucl_sq_;
+
+    // **** variables
+
+    PointCloudFeature::Ptr model_ptr_; ///< The model point cloud
+    int model_idx_;         ///< Current intex in the ring buffer
+    int model_size_;        ///< Current model size
+    Vector3fVector means_;  ///< Vector of model feature mean
+    Matrix3fVector covariances_; ///< Vector of model feature covariances
+
+    VoxelHashIndex model_index_; ///< NN index over the model means
+
+    Matrix3f I_; ///< 3x3 Identity matrix
+    
+    AffineTransform f2b_; ///< Transform from fixed to moving frame
+    
+    // **** reused buffers
+
+    Vector3fVector data_means_;
+    Matrix3fVector data_covariances_;
+    PointCloudFeature data_cloud_;
+    IntVector data_indices_, model_indices_;
+    IntVector nn_indices_;
+    FloatVector nn_dists_sq_;
+    
+    // ***** funtions
+  
+    /** @brief Performs ICP alignment using the Euclidean distance for corresopndences
+     * 
+     * @param data_means a vector of 3x1 matrices, repesenting the 3D positions of the features
+     * @param correction reference to the resulting transformation
+     * @retval true the motion estimation was successful
+     * @retval false the motion estimation failed
+     */
+    bool alignICPEuclidean(
+      const Vector3fVector& data_means,
+      AffineTransform& correction);
+
+    /** @brief Finds the correspondences of the data cloud in the model,
+     * within the maximum Euclidean correspondence distance
+     */
+    void getCorrespEuclidean(
+      const PointCloudFeature& data_cloud,
+      IntVector& data_indices,
+      IntVector& model_indices);
+    
+    /** @brief Finds the nearest Mahalanobis neighbor among the
+     * n_nearest_neighbors_ closest Euclidean neighbors
+     * 
+     * @param data_mean 3x1 matrix of the query 3D position
+     * @param data_cov 3x3 matrix of the query 3D position covariance
+     * @param mah_nn_idx the index of the Mahalanobis nearest neighbor
+     * @param mah_dist_sq the squared Mahalanobis distance to the neighbor
+     * @retval true a neighbor was found
+     * @retval false no neighbors in the neighborhood of the query
+     */
+    bool getNNMahalanobis(
+      const Vector3f& data_mean, const Matrix3f& data_cov,
+      int& mah_nn_idx, double& mah_dist_sq);
+
+    /** @brief Creates the model from the first frame
+     */
+    void initializeModelFromData(
+      const Vector3fVector& data_means,
+      const Matrix3fVector& data_covariances);
+    
+    /** @brief Updates the model with the data, using a Kalman Filter
+     * for the associated points, and adding the unassociated points
+     */
+    void updateModelFromData(
+      const Vector3fVector& data_means,
+      const Matrix3fVector& data_covariances);
+
+    /** @brief Adds a point to the model, replacing the oldest point
+     * once the model is full
+     */
+    void addToModel(
+      const Vector3f& data_mean,
+      const Matrix3f& data_cov);
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_MOTION_ESTIMATION_ICP_PROB_MODEL_VOXEL_H
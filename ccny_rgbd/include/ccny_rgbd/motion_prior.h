@@ -0,0 +1,142 @@
+/**
+ *  @file motion_prior.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_MOTION_PRIOR_H
+#define CCNY_RGBD_MOTION_PRIOR_H
+
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+#include <nav_msgs/Odometry.h>
+
+#include "ccny_rgbd/types.h"
+#include "ccny_rgbd/pose_buffer.h"
+
+namespace ccny_rgbd {
+
+/** @brief Base class for motion priors, which predict the pose
+ * of the base frame at the time of a new RGBD frame, before registration.
+ * 
+ * The prediction is used to seed the registration, so that the 
+ * ICP starts closer to the solution.
+ */
+class MotionPrior
+{
+  public:
+
+    virtual ~MotionPrior() {}
+
+    /** @brief Predicts the pose of the base at a given time
+     * @param stamp the time of the new frame
+     * @param f2b the last estimated fixed-to-base transform
+     * @param f2b_pred the predicted fixed-to-base transform
+     * @retval true a prediction was made
+     * @retval false no prediction available; f2b_pred is left unchanged
+     */
+    virtual bool getPrediction(
+      const ros::Time& stamp,
+      const tf::Transform& f2b,
+      tf::Transform& f2b_pred) = 0;
+
+    /** @brief Informs the prior of the registered pose of a frame
+     * @param stamp the time of the frame
+     * @param f2b the estimated fixed-to-base transform
+     */
+    virtual void update(
+      const ros::Time& stamp,
+      const tf::Transform& f2b) = 0;
+};
+
+typedef boost::shared_ptr<MotionPrior> MotionPriorPtr;
+
+/** @brief Predicts the pose by assuming constant velocity (in the 
+ * base frame) over the last two registered poses.
+ */
+class ConstantVelocityMotionPrior: public MotionPrior
+{
+  public:
+
+    ConstantVelocityMotionPrior();
+
+    bool getPrediction(
+      const ros::Time& stamp,
+      const tf::Transform& f2b,
+      tf::Transform& f2b_pred);
+
+    void update(
+      const ros::Time& stamp,
+      const tf::Transform& f2b);
+
+  private:
+
+    int n_poses_;             ///< number of poses received (saturates at 2)
+    ros::Time stamp_prev_;    ///< time of the second-to-last pose
+    ros::Time stamp_last_;    ///< time of the last pose
+    tf::Transform f2b_prev_;  ///< second-to-last pose
+    tf::Transform f2b_last_;  ///< last pose
+};
+
+/** @brief Predicts the pose from the motion reported by an external 
+ * odometry source (wheel odometry, or an IMU-based filter publishing
+ * nav_msgs/Odometry) between the last registered frame and the new frame.
+ * 
+ * The odometry is assumed to describe the motion of the same base frame 
+ * as the visual odometry.
+ */
+class OdometryMotionPrior: public MotionPrior
+{
+  public:
+
+    /** @brief Constructor
+     * @param nh the nodehandle used to subscribe to the odometry
+     * @param topic the odometry topic
+     * @param buffer_duration how long to keep odometry messages (in seconds)
+     */
+    OdometryMotionPrior(
+      ros::NodeHandle& nh, 
+      const std::string& topic,
+      double buffer_duration);
+
+    bool getPrediction(
+      const ros::Time& stamp,
+      const tf::Transform& f2b,
+      tf::Transform& f2b_pred);
+
+    void update(
+      const ros::Time& stamp,
+      const tf::Transform& f2b);
+
+  private:
+
+    ros::Subscriber odom_subscriber_; ///< odometry subscriber
+
+    PoseBuffer buffer_;     ///< odometry poses
+
+    bool has_last_;         ///< whether a frame has been registered
+    ros::Time stamp_last_;  ///< time of the last registered frame
+
+    void odomCallback(const OdomMsg::ConstPtr& odom_msg);
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_MOTION_PRIOR_H
@@ -0,0 +1,111 @@
+/**
+ *  @file pose_buffer.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_POSE_BUFFER_H
+#define CCNY_RGBD_POSE_BUFFER_H
+
+#include <deque>
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+#include <boost/thread/mutex.hpp>
+
+namespace ccny_rgbd {
+
+/** @brief Thread-safe buffer of stamped poses, covering a sliding 
+ * window of time, which interpolates the pose at arbitrary times.
+ *
+ * Used to look up poses from a stream of odometry messages without
+ * blocking, as an alternative to tf::TransformListener::waitForTransform.
+ */
+class PoseBuffer
+{
+  public:
+
+    /** @brief Result of a lookup
+     */
+    enum LookupResult
+    {
+      FOUND,          ///< the pose was interpolated
+      NOT_AVAILABLE,  ///< the time is newer than the buffer, or the buffer is empty
+      TOO_OLD         ///< the time is older than the buffer
+    };
+
+    /** @brief Constructor
+     * @param duration how long to keep poses (in seconds)
+     */
+    explicit PoseBuffer(double duration);
+
+    /** @brief Sets how long to keep poses
+     * @param duration the duration (in seconds)
+     */
+    void setDuration(double duration);
+
+    /** @brief Appends a pose, and removes the poses which are older than
+     * the buffer duration. A pose older than the last one resets the 
+     * buffer (for example, after a bag restart).
+     * @param stamp the time of the pose
+     * @param pose the pose
+     */
+    void add(const ros::Time& stamp, const tf::Transform& pose);
+
+    /** @brief Interpolates the pose at a given time
+     * @param stamp the time to look up
+     * @param pose the interpolated pose (unchanged unless FOUND)
+     * @return the result of the lookup
+     */
+    LookupResult lookup(const ros::Time& stamp, tf::Transform& pose) const;
+
+    /** @brief Removes all the poses
+     */
+    void clear();
+
+  private:
+
+    /** @brief Stamped pose
+     */
+    struct StampedTf
+    {
+      ros::Time stamp;
+      tf::Transform pose;
+    };
+
+    /** @brief Compares stamped poses by time, for the binary search
+     */
+    static bool stampLess(const StampedTf& a, const ros::Time& stamp)
+    {
+      return a.stamp < stamp;
+    }
+
+    mutable boost::mutex mutex_;    ///< guards the buffer
+    std::deque<StampedTf> buffer_;  ///< poses, by increasing time
+    ros::Duration duration_;        ///< how long to keep poses
+};
+
+/** @brief Scales a transform by interpolating between the identity 
+ * and the transform (or extrapolating, for scale > 1).
+ */
+tf::Transform scaleTransform(const tf::Transform& transform, double scale);
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_POSE_BUFFER_H
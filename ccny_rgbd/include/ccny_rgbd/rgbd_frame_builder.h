@@ -0,0 +1,139 @@
+/**
+ *  @file rgbd_frame_builder.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_RGBD_FRAME_BUILDER_H
+#define CCNY_RGBD_RGBD_FRAME_BUILDER_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <rgbdtools/rgbdtools.h>
+
+#include "ccny_rgbd/types.h"
+
+namespace ccny_rgbd {
+
+typedef boost::shared_ptr<rgbdtools::RGBDFrame> RGBDFramePtr;
+
+/** @brief Builds RGBDFrames from ROS messages without steady-state 
+ * heap allocations.
+ * 
+ * Compared to createRGBDFrameFromROSMessages:
+ *  - the intrinsic matrix is only rebuilt when the CameraInfo 
+ *    contents change, and shared by all the frames;
+ *  - 32FC1 depth images are converted into a 16UC1 buffer which
+ *    is reused, as long as no one else references it;
+ *  - frames are handed out by acquire() and return to a pool
+ *    when the last reference to them is released, so their 
+ *    keypoint and distribution vectors keep their capacity.
+ * 
+ * acquire() and build() can be called from multiple threads.
+ */
+class RGBDFrameBuilder
+{
+  public:
+
+    /** @brief Constructor
+     * @param max_pool_size maximum number of idle frames kept in the pool
+     */
+    explicit RGBDFrameBuilder(int max_pool_size = 8);
+
+    /** @brief Returns a frame from the pool (or a new one if the pool is
+     * empty). The frame returns to the pool when the last copy of the 
+     * pointer is destroyed, which can happen after the builder itself
+     * is destroyed.
+     */
+    RGBDFramePtr acquire();
+
+    /** @brief Fills out a frame from ROS messages. The feature data of
+     * the frame is cleared.
+     * 
+     * @param rgb_msg the rgb image message
+     * @param depth_msg the depth image message (16UC1 or 32FC1)
+     * @param info_msg the camera info message
+     * @param frame the frame to fill out
+     */
+    void build(
+      const ImageMsg::ConstPtr& rgb_msg,
+      const ImageMsg::ConstPtr& depth_msg,
+      const CameraInfoMsg::ConstPtr& info_msg,
+      rgbdtools::RGBDFrame& frame);
+
+    /** @brief Number of idle frames currently in the pool
+     */
+    int getPoolSize() const;
+
+  private:
+
+    /** @brief Pool state, shared with the deleters of the 
+     * frames handed out, so it can outlive the builder
+     */
+    struct Pool
+    {
+      boost::mutex mutex;                        ///< state mutex
+      std::vector<rgbdtools::RGBDFrame*> frames; ///< idle frames
+      int max_size;                              ///< max. idle frames
+    };
+
+    /** @brief Deleter which returns a frame to the pool
+     */
+    struct Recycler
+    {
+      boost::shared_ptr<Pool> pool;
+      void operator()(rgbdtools::RGBDFrame * frame);
+    };
+
+    boost::shared_ptr<Pool> pool_; ///< the frame pool
+
+    boost::mutex intr_mutex_;      ///< protects the intrinsics cache
+    CameraInfoMsg::_K_type cached_K_;  ///< K of the cached intrinsics
+    CameraInfoMsg::_D_type cached_D_;  ///< D of the cached intrinsics
+    cv::Mat intr_;                 ///< cached intrinsic matrix
+
+    /** @brief Returns the intrinsic matrix for a camera info message, 
+     * rebuilding it only if the contents differ from the cached ones.
+     */
+    cv::Mat getIntrinsics(const CameraInfoMsg::ConstPtr& info_msg);
+};
+
+/** @brief Converts a 32FC1 depth image (in meters) to a 16UC1 depth 
+ * image (in mm). Invalid readings become 0.
+ * 
+ * The output buffer is reused if it has the right size and type.
+ * 
+ * @param depth_img_in the 32FC1 input image
+ * @param depth_img_out the 16UC1 output image
+ */
+void depthImageFloatTo16bitReuse(
+  const cv::Mat& depth_img_in, 
+  cv::Mat& depth_img_out);
+
+/** @brief Checks whether a cv::Mat is the only reference to its 
+ * buffer, ie, whether its contents can be overwritten safely.
+ * False for a Mat wrapping external data, and for an empty Mat.
+ */
+bool isUniqueBuffer(const cv::Mat& mat);
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_RGBD_FRAME_BUILDER_H
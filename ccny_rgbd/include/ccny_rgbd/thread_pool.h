@@ -0,0 +1,105 @@
+/**
+ *  @file thread_pool.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_THREAD_POOL_H
+#define CCNY_RGBD_THREAD_POOL_H
+
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace ccny_rgbd {
+
+/** @brief Fixed set of worker threads for running data-parallel work.
+ *
+ * The caller of run() blocks until all the tasks of its batch are done,
+ * and takes part in processing them, so a pool with 0 threads runs
+ * everything on the calling thread. Several threads may call run() 
+ * concurrently.
+ */
+class ThreadPool
+{
+  public:
+
+    typedef boost::function<void(int)> Task;
+
+    /** @brief Constructor
+     * @param n_threads the number of worker threads. If negative, 
+     * uses one less than the number of hardware threads (the caller
+     * of run() does the remaining share of the work).
+     */
+    explicit ThreadPool(int n_threads = -1);
+
+    /** @brief Destructor. Waits for the workers to exit.
+     */
+    virtual ~ThreadPool();
+
+    /** @brief Runs task(0) ... task(n_tasks - 1), and returns when
+     * all of them are done. The tasks must not throw.
+     * @param n_tasks the number of tasks
+     * @param task the function to call for each task index
+     */
+    void run(int n_tasks, const Task& task);
+
+    /** @brief Number of worker threads
+     */
+    int getNumThreads() const { return threads_.size(); }
+
+  private:
+
+    /** @brief Progress of one call to run()
+     */
+    struct Batch
+    {
+      const Task* task;  ///< the task function
+      int n_tasks;       ///< total number of tasks
+      int next;          ///< next task index to hand out
+      int n_done;        ///< number of completed tasks
+    };
+
+    std::vector<boost::thread*> threads_; ///< the workers
+
+    boost::mutex mutex_;                  ///< guards the state below
+    boost::condition_variable work_cond_; ///< signalled when work is added
+    boost::condition_variable done_cond_; ///< signalled when a batch completes
+    std::deque<Batch*> batches_;          ///< batches with tasks left to hand out
+    bool shutdown_;                       ///< whether the workers should exit
+
+    void workerThread();
+
+    /** @brief Takes the next task index from the oldest batch. 
+     * Must be called with mutex_ held.
+     * @retval false no tasks left to hand out
+     */
+    bool takeTask(Batch*& batch, int& task_idx);
+
+    /** @brief Marks a task as done. Must be called with mutex_ held.
+     */
+    void finishTask(Batch* batch);
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_THREAD_POOL_H
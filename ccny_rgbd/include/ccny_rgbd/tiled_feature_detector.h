@@ -0,0 +1,113 @@
+/**
+ *  @file tiled_feature_detector.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_TILED_FEATURE_DETECTOR_H
+#define CCNY_RGBD_TILED_FEATURE_DETECTOR_H
+
+#include <rgbdtools/rgbdtools.h>
+
+#include "ccny_rgbd/types.h"
+#include "ccny_rgbd/thread_pool.h"
+
+namespace ccny_rgbd {
+
+/** @brief Runs feature detection on a grid of image tiles in parallel.
+ * 
+ * Each tile has its own detector (of the same type and configuration,
+ * with a share of the total feature count). The tiles are run through
+ * the detectors as RGBD frames of their own, with the intrinsics shifted
+ * to the tile origin, so the 3D distributions are computed in parallel
+ * too, and come out in the camera frame of the full image.
+ * 
+ * Tiles are enlarged by an overlap margin, so that detectors which
+ * ignore image borders still find features near the tile seams. Only
+ * the features inside the tile itself are kept.
+ * 
+ * Descriptors are not merged.
+ */
+class TiledFeatureDetector
+{
+  public:
+
+    /** @brief Constructor
+     * @param rows number of tile rows
+     * @param cols number of tile columns
+     * @param overlap overlap margin around each tile, in pixels
+     * @param pool thread pool for running the tiles
+     */
+    TiledFeatureDetector(
+      int rows, int cols, int overlap, 
+      const boost::shared_ptr<ThreadPool>& pool);
+
+    /** @brief Sets the per-tile detectors (rows * cols of them)
+     */
+    void setDetectors(const std::vector<rgbdtools::FeatureDetectorPtr>& detectors);
+
+    /** @brief The per-tile detectors, in row-major order
+     */
+    const std::vector<rgbdtools::FeatureDetectorPtr>& getDetectors() const 
+    { 
+      return detectors_; 
+    }
+
+    int getNumTiles() const { return rows_ * cols_; }
+
+    /** @brief Share of a total feature count for one of the tiles.
+     * The shares of all the tiles add up to the total.
+     * @param n_features the total feature count
+     * @param tile_idx the tile index
+     */
+    int getTileQuota(int n_features, int tile_idx) const;
+
+    /** @brief Detects features in all tiles, and merges them into
+     * the keypoints and distributions of the frame
+     */
+    void findFeatures(rgbdtools::RGBDFrame& frame);
+
+  private:
+
+    int rows_;     ///< number of tile rows
+    int cols_;     ///< number of tile columns
+    int overlap_;  ///< overlap margin, in pixels
+
+    boost::shared_ptr<ThreadPool> pool_; ///< runs the tiles
+
+    std::vector<rgbdtools::FeatureDetectorPtr> detectors_; ///< one per tile
+
+    std::vector<rgbdtools::RGBDFrame> tile_frames_; ///< reused tile frames
+    std::vector<cv::Rect> tiles_;  ///< tile areas, without overlap
+    std::vector<cv::Rect> rois_;   ///< tile areas, with overlap
+    std::vector<cv::Mat> intrs_;   ///< reused tile intrinsic matrices
+
+    rgbdtools::RGBDFrame * frame_; ///< the frame being processed
+
+    void computeTiles(int width, int height);
+
+    /** @brief Detects features in one of the tiles (runs on the pool)
+     */
+    void detectTile(int tile_idx);
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_TILED_FEATURE_DETECTOR_H
@@ -185,6 +185,35 @@ void pathROSToEigenAffine(
   const PathMsg& path_msg,
   AffineTransformVector& path);
 
+/** @brief Copies over the valid means. The output vector is 
+ * appended to, not cleared.
+ */
+void removeInvalidMeans(
+  const Vector3fVector& means,
+  const BoolVector& valid,
+  Vector3fVector& means_f);
+
+/** @brief Copies over the valid means and covariances. The output 
+ * vectors are appended to, not cleared.
+ */
+void removeInvalidDistributions(
+  const Vector3fVector& means,
+  const Matrix3fVector& covariances,
+  const BoolVector& valid,
+  Vector3fVector& means_f,
+  Matrix3fVector& covariances_f);
+
+/** @brief Transforms a set of 3D distributions in place
+ * 
+ * @param means the means, transformed as points
+ * @param covariances the covariances, rotated
+ * @param transform the transform to apply
+ */
+void transformDistributions(
+  Vector3fVector& means,
+  Matrix3fVector& covariances,
+  const AffineTransform& transform);
+
 } // namespace ccny_rgbd
 
 #endif // CCNY_RGBD_RGBD_UTIL_H
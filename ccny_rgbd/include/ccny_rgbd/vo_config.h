@@ -0,0 +1,123 @@
+/**
+ *  @file vo_config.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_VO_CONFIG_H
+#define CCNY_RGBD_VO_CONFIG_H
+
+#include <string>
+#include <rgbdtools/rgbdtools.h>
+
+namespace ccny_rgbd {
+
+/** @brief Configures the generic feature detector parameters (smoothing,
+ * range and uncertainty thresholds) from the "feature/" parameters.
+ *
+ * The ParamSource type needs a getParam(name, value) method for int, double,
+ * bool and std::string values, which returns false if the parameter is not 
+ * set. ros::NodeHandle is one such type. This lets the VisualOdometry app
+ * and the offline benchmark share the same parameter names and defaults.
+ * 
+ * @param params the parameter source
+ * @param detector the detector to configure
+ */
+template <class ParamSource>
+void configureFeatureDetector(
+  const ParamSource& params,
+  rgbdtools::FeatureDetector& detector)
+{
+  int smooth;
+  double max_range, max_stdev;
+  
+  if (!params.getParam ("feature/smooth", smooth))
+    smooth = 0;
+  if (!params.getParam ("feature/max_range", max_range))
+    max_range = 5.5;
+  if (!params.getParam ("feature/max_stdev", max_stdev))
+    max_stdev = 0.03;
+  
+  detector.setSmooth(smooth);
+  detector.setMaxRange(max_range);
+  detector.setMaxStDev(max_stdev);
+}
+
+/** @brief Configures the ICPProbModel motion estimation from the "reg/" 
+ * parameters.
+ * 
+ * See \ref configureFeatureDetector for the requirements on ParamSource.
+ * MotionEstimationType is either rgbdtools::MotionEstimationICPProbModel 
+ * or MotionEstimationICPProbModelVoxel, which share the same setters.
+ * 
+ * @param params the parameter source
+ * @param motion_estimation the motion estimation to configure
+ */
+template <class ParamSource, class MotionEstimationType>
+void configureMotionEstimation(
+  const ParamSource& params,
+  MotionEstimationType& motion_estimation)
+{
+  int motion_constraint;
+
+  if (!params.getParam ("reg/motion_constraint", motion_constraint))
+    motion_constraint = 0;
+
+  motion_estimation.setMotionConstraint(motion_constraint);
+
+  double tf_epsilon_linear;
+  double tf_epsilon_angular;
+  int max_iterations;
+  int min_correspondences;
+  int max_model_size;
+  double max_corresp_dist_eucl;
+  double max_assoc_dist_mah;
+  int n_nearest_neighbors;   
+
+  if (!params.getParam ("reg/ICPProbModel/tf_epsilon_linear", tf_epsilon_linear))
+    tf_epsilon_linear = 1e-4; // 1 mm
+  if (!params.getParam ("reg/ICPProbModel/tf_epsilon_angular", tf_epsilon_angular))
+    tf_epsilon_angular = 1.7e-3; // 1 deg
+  if (!params.getParam ("reg/ICPProbModel/max_iterations", max_iterations))
+    max_iterations = 10;
+  if (!params.getParam ("reg/ICPProbModel/min_correspondences", min_correspondences))
+    min_correspondences = 15;
+  if (!params.getParam ("reg/ICPProbModel/max_model_size", max_model_size))
+    max_model_size = 3000;
+  if (!params.getParam ("reg/ICPProbModel/max_corresp_dist_eucl", max_corresp_dist_eucl))
+    max_corresp_dist_eucl = 0.15;
+  if (!params.getParam ("reg/ICPProbModel/max_assoc_dist_mah", max_assoc_dist_mah))
+    max_assoc_dist_mah = 10.0;
+  if (!params.getParam ("reg/ICPProbModel/n_nearest_neighbors", n_nearest_neighbors))
+    n_nearest_neighbors = 4;      
+    
+  motion_estimation.setTfEpsilonLinear(tf_epsilon_linear);
+  motion_estimation.setTfEpsilonAngular(tf_epsilon_angular);
+  motion_estimation.setMaxIterations(max_iterations);
+  motion_estimation.setMinCorrespondences(min_correspondences);
+  motion_estimation.setMaxModelSize(max_model_size);
+  motion_estimation.setMaxCorrespondenceDistEuclidean(max_corresp_dist_eucl);
+  motion_estimation.setMaxAssociationDistMahalanobis(max_assoc_dist_mah);
+  motion_estimation.setNNearestNeighbors(n_nearest_neighbors);
+}
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_VO_CONFIG_H
@@ -0,0 +1,119 @@
+/**
+ *  @file voxel_grid_accumulator.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_VOXEL_GRID_ACCUMULATOR_H
+#define CCNY_RGBD_VOXEL_GRID_ACCUMULATOR_H
+
+#include <boost/unordered_map.hpp>
+
+#include "ccny_rgbd/types.h"
+#include "ccny_rgbd/voxel_hash_index.h"
+
+namespace ccny_rgbd {
+
+/** @brief Downsamples point clouds incrementally onto a voxel grid.
+ *
+ * Each occupied voxel accumulates the sum of the positions and colors
+ * of its points, and is output as their centroid (with the average
+ * color), like pcl::VoxelGrid. Unlike pcl::VoxelGrid, clouds can be 
+ * added one at a time without aggregating them first, and accumulators
+ * built in parallel can be merged exactly.
+ */
+class VoxelGridAccumulator
+{
+  public:
+
+    /** @brief Constructor
+     * @param leaf_size the voxel size (in meters)
+     */
+    explicit VoxelGridAccumulator(double leaf_size);
+
+    /** @brief Transforms a cloud and adds its points. NaN points, and
+     * points above max_z (after the transform) are skipped.
+     * @param cloud the cloud
+     * @param pose the transform applied to the cloud
+     * @param max_z the maximum z coordinate
+     */
+    void add(const PointCloudT& cloud, 
+             const AffineTransform& pose, 
+             double max_z);
+
+    /** @brief Removes the points of a cloud previously added with add(),
+     * with the same pose and max_z
+     * @param cloud the cloud
+     * @param pose the transform which was applied to the cloud
+     * @param max_z the maximum z coordinate
+     */
+    void remove(const PointCloudT& cloud, 
+                const AffineTransform& pose, 
+                double max_z);
+
+    /** @brief Adds the voxels of another accumulator (with the same 
+     * leaf size) to this one
+     */
+    void merge(const VoxelGridAccumulator& other);
+
+    /** @brief Exchanges the contents with another accumulator
+     */
+    void swap(VoxelGridAccumulator& other);
+
+    /** @brief Removes all the voxels
+     */
+    void clear() { voxels_.clear(); }
+
+    /** @brief Outputs one point per occupied voxel
+     * @param cloud the downsampled cloud
+     */
+    void getCloud(PointCloudT& cloud) const;
+
+    /** @brief Number of occupied voxels
+     */
+    size_t size() const { return voxels_.size(); }
+
+  private:
+
+    /** @brief Sums of the points in a voxel
+     */
+    struct Voxel
+    {
+      double x, y, z;  ///< sum of the coordinates
+      double r, g, b;  ///< sum of the colors
+      int n;           ///< number of points
+    };
+
+    typedef boost::unordered_map<VoxelKey, Voxel> VoxelMap;
+
+    /** @brief Adds (weight 1) or removes (weight -1) the points of a cloud
+     */
+    void accumulate(const PointCloudT& cloud, 
+                    const AffineTransform& pose, 
+                    double max_z,
+                    int weight);
+
+    double leaf_size_; ///< voxel size
+    VoxelMap voxels_;  ///< the occupied voxels
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_VOXEL_GRID_ACCUMULATOR_H
@@ -0,0 +1,149 @@
+/**
+ *  @file voxel_hash_index.h
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CCNY_RGBD_VOXEL_HASH_INDEX_H
+#define CCNY_RGBD_VOXEL_HASH_INDEX_H
+
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+
+#include "ccny_rgbd/types.h"
+
+namespace ccny_rgbd {
+
+/** @brief Integer coordinates of a voxel
+ */
+struct VoxelKey
+{
+  int x, y, z;
+
+  bool operator==(const VoxelKey& other) const
+  {
+    return x == other.x && y == other.y && z == other.z;
+  }
+};
+
+inline std::size_t hash_value(const VoxelKey& key)
+{
+  std::size_t seed = 0;
+  boost::hash_combine(seed, key.x);
+  boost::hash_combine(seed, key.y);
+  boost::hash_combine(seed, key.z);
+  return seed;
+}
+
+/** @brief Nearest-neighbor index over a set of 3D points, 
+ * using a hash map of voxels.
+ * 
+ * The index does not store the points themselves, only their
+ * indices in an external point vector, bucketed by voxel. Points can
+ * be inserted, moved and removed individually, so the index never
+ * needs to be rebuilt.
+ * 
+ * Searches only look at the voxel of the query point and its 26 
+ * neighbors, so all points closer than the voxel size are guaranteed 
+ * to be considered. Points further away may not be found.
+ */
+class VoxelHashIndex
+{
+  public:
+
+    /** @brief Constructor
+     * @param voxel_size the voxel size (in meters)
+     */
+    explicit VoxelHashIndex(double voxel_size = 0.15);
+
+    /** @brief Sets the voxel size, and clears the index
+     */
+    void setVoxelSize(double voxel_size);
+
+    /** @brief Removes all the points
+     */
+    void clear();
+
+    /** @brief Adds a point
+     * @param idx the index of the point
+     * @param point the point coordinates
+     */
+    void insert(int idx, const Vector3f& point);
+
+    /** @brief Removes a point
+     * @param idx the index of the point
+     * @param point the coordinates with which the point was inserted
+     */
+    void remove(int idx, const Vector3f& point);
+
+    /** @brief Updates the coordinates of a point
+     * @param idx the index of the point
+     * @param old_point the previous coordinates of the point
+     * @param new_point the new coordinates of the point
+     */
+    void move(int idx, const Vector3f& old_point, const Vector3f& new_point);
+
+    /** @brief Finds the closest point to a query point
+     * @param query the query point
+     * @param points the point vector which the indices refer to
+     * @param nn_idx the index of the closest point
+     * @param nn_dist_sq the squared distance to the closest point
+     * @retval true a point was found
+     * @retval false no points in the neighborhood of the query
+     */
+    bool nearest(
+      const Vector3f& query, 
+      const Vector3fVector& points,
+      int& nn_idx, 
+      double& nn_dist_sq) const;
+
+    /** @brief Finds the k closest points to a query point, 
+     * sorted by increasing distance
+     * @param query the query point
+     * @param points the point vector which the indices refer to
+     * @param k the number of neighbors
+     * @param indices the indices of the neighbors, resized to k
+     * @param dists_sq the squared distances to the neighbors, resized to k
+     * @return the number of neighbors found (at most k)
+     */
+    int nearestK(
+      const Vector3f& query,
+      const Vector3fVector& points,
+      int k,
+      IntVector& indices,
+      FloatVector& dists_sq) const;
+
+    /** @brief Number of non-empty voxels
+     */
+    int getNumVoxels() const { return voxels_.size(); }
+
+  private:
+
+    typedef boost::unordered_map<VoxelKey, IntVector> VoxelMap;
+
+    double voxel_size_;  ///< voxel size, in meters
+    VoxelMap voxels_;    ///< point indices, by voxel
+
+    VoxelKey getKey(const Vector3f& point) const;
+};
+
+} // namespace ccny_rgbd
+
+#endif // CCNY_RGBD_VOXEL_HASH_INDEX_H
@@ -30,7 +30,14 @@ KeyframeMapper::KeyframeMapper(
   const ros::NodeHandle& nh_private):
   nh_(nh), 
   nh_private_(nh_private),
-  rgbd_frame_index_(0)
+  live_map_(0.01),
+  live_map_valid_(true),
+  live_map_dirty_(false),
+  live_octomap_reset_(false),
+  rgbd_frame_index_(0),
+  pose_buffer_(2.0),
+  n_dropped_frames_(0),
+  has_b2c_(false)
 {
   ROS_INFO("Starting RGBD Keyframe Mapper");
    
@@ -38,16 +45,37 @@ KeyframeMapper::KeyframeMapper(
   
   initParams();
   
+  if (use_live_octomap_) resetLiveOctomap();
+  
   // **** publishers
   
-  keyframes_pub_ = nh_.advertise<PointCloudT>(
-    "keyframes", queue_size_);
-  poses_pub_ = nh_.advertise<visualization_msgs::Marker>( 
-    "keyframe_poses", queue_size_);
-  kf_assoc_pub_ = nh_.advertise<visualization_msgs::Marker>( 
-    "keyframe_associations", queue_size_);
-  path_pub_ = nh_.advertise<PathMsg>( 
-    "mapper_path", queue_size_);
+  // the messages are only built when the topics have subscribers
+  keyframes_pub_.advertise<PointCloudT>(
+    nh_, "keyframes", queue_size_);
+  poses_pub_.advertise<visualization_msgs::Marker>( 
+    nh_, "keyframe_poses", queue_size_);
+  kf_assoc_pub_.advertise<visualization_msgs::Marker>( 
+    nh_, "keyframe_associations", queue_size_);
+  path_pub_.advertise<PathMsg>( 
+    nh_, "mapper_path", queue_size_, path_rate_);
+  map_pub_.advertise<PointCloudT>( 
+    nh_, "map", queue_size_, 0.0, true);
+  
+  if (use_live_map_ && map_rate_ > 0.0)
+  {
+    map_timer_ = nh_.createTimer(
+      ros::Duration(1.0 / map_rate_), 
+      &KeyframeMapper::mapTimerCallback, this);
+  }
+  octomap_updates_pub_.advertise<OctomapUpdate>( 
+    nh_, "octomap_updates", queue_size_);
+  
+  if (use_live_octomap_ && octomap_rate_ > 0.0)
+  {
+    octomap_timer_ = nh_.createTimer(
+      ros::Duration(1.0 / octomap_rate_), 
+      &KeyframeMapper::octomapTimerCallback, this);
+  }
   
   // **** services
   
@@ -69,21 +97,37 @@ KeyframeMapper::KeyframeMapper(
     "generate_graph", &KeyframeMapper::generateGraphSrvCallback, this);
    solve_graph_service_ = nh_.advertiseService(
     "solve_graph", &KeyframeMapper::solveGraphSrvCallback, this);
+  get_octomap_service_ = nh_.advertiseService(
+    "get_octomap", &KeyframeMapper::getOctomapSrvCallback, this);
  
   // **** subscribers
 
-  ImageTransport rgb_it(nh_);
-  ImageTransport depth_it(nh_);
-
-  sub_rgb_.subscribe(rgb_it,     "/rgbd/rgb",   queue_size_);
-  sub_depth_.subscribe(depth_it, "/rgbd/depth", queue_size_);
-  sub_info_.subscribe(nh_,       "/rgbd/info",  queue_size_);
-
-  // Synchronize inputs.
-  sync_.reset(new RGBDSynchronizer3(
-                RGBDSyncPolicy3(queue_size_), sub_rgb_, sub_depth_, sub_info_));
-   
-  sync_->registerCallback(boost::bind(&KeyframeMapper::RGBDCallback, this, _1, _2, _3));  
+  if (use_keyframe_bundles_)
+  {
+    // keyframe candidates (images and pose), from the VisualOdometry app
+    bundle_sub_ = nh_.subscribe(
+      "keyframe_bundles", queue_size_, 
+      &KeyframeMapper::keyframeBundleCallback, this);
+  }
+  else
+  {
+    // poses of the base frame, usually from the VisualOdometry app
+    odom_sub_ = nh_.subscribe(
+      "vo", 100, &KeyframeMapper::odomCallback, this);
+
+    ImageTransport rgb_it(nh_);
+    ImageTransport depth_it(nh_);
+
+    sub_rgb_.subscribe(rgb_it,     "/rgbd/rgb",   queue_size_);
+    sub_depth_.subscribe(depth_it, "/rgbd/depth", queue_size_);
+    sub_info_.subscribe(nh_,       "/rgbd/info",  queue_size_);
+
+    // Synchronize inputs.
+    sync_.reset(new RGBDSynchronizer3(
+                  RGBDSyncPolicy3(queue_size_), sub_rgb_, sub_depth_, sub_info_));
+     
+    sync_->registerCallback(boost::bind(&KeyframeMapper::RGBDCallback, this, _1, _2, _3));  
+  }
 }
 
 KeyframeMapper::~KeyframeMapper()
@@ -101,12 +145,29 @@ void KeyframeMapper::initParams()
     queue_size_ = 5;
   if (!nh_private_.getParam ("fixed_frame", fixed_frame_))
     fixed_frame_ = "/odom";
+  if (!nh_private_.getParam ("base_frame", base_frame_))
+    base_frame_ = "/base_link";
+  odom_child_frame_ = base_frame_;
   if (!nh_private_.getParam ("pcd_map_res", pcd_map_res_))
     pcd_map_res_ = 0.01;
   if (!nh_private_.getParam ("octomap_res", octomap_res_))
     octomap_res_ = 0.05;
   if (!nh_private_.getParam ("octomap_with_color", octomap_with_color_))
    octomap_with_color_ = true;
+  if (!nh_private_.getParam ("octomap_max_range", octomap_max_range_))
+    octomap_max_range_ = -1.0;
+  if (!nh_private_.getParam ("octomap_lazy_eval", octomap_lazy_eval_))
+    octomap_lazy_eval_ = false;
+  if (!nh_private_.getParam ("octomap_parallel", octomap_parallel_))
+    octomap_parallel_ = true;
+  if (!nh_private_.getParam ("live_octomap", use_live_octomap_))
+    use_live_octomap_ = false;
+  if (!nh_private_.getParam ("octomap_rate", octomap_rate_))
+    octomap_rate_ = 1.0;
+  if (!nh_private_.getParam ("reintegration/dist_eps", reintegration_dist_eps_))
+    reintegration_dist_eps_ = 0.01;
+  if (!nh_private_.getParam ("reintegration/angle_eps", reintegration_angle_eps_))
+    reintegration_angle_eps_ = 0.01;
   if (!nh_private_.getParam ("kf_dist_eps", kf_dist_eps_))
     kf_dist_eps_  = 0.10;
   if (!nh_private_.getParam ("kf_angle_eps", kf_angle_eps_))
@@ -117,6 +178,67 @@ void KeyframeMapper::initParams()
     max_stdev_  = 0.03;
   if (!nh_private_.getParam ("max_map_z", max_map_z_))
     max_map_z_ = std::numeric_limits<double>::infinity();
+  if (!nh_private_.getParam ("map_threads", map_threads_))
+    map_threads_ = -1;
+  if (!nh_private_.getParam ("path_rate", path_rate_))
+    path_rate_ = 0.0;
+  if (!nh_private_.getParam ("compress_keyframes", compress_keyframes_))
+    compress_keyframes_ = false;
+  
+  bool compression_rgb_lossless;
+  int compression_jpeg_quality, compression_cache_size;
+  if (!nh_private_.getParam ("compression/rgb_lossless", compression_rgb_lossless))
+    compression_rgb_lossless = false;
+  if (!nh_private_.getParam ("compression/jpeg_quality", compression_jpeg_quality))
+    compression_jpeg_quality = 95;
+  if (!nh_private_.getParam ("compression/cache_size", compression_cache_size))
+    compression_cache_size = 8;
+  
+  image_store_.setRgbCoding(compression_rgb_lossless, compression_jpeg_quality);
+  image_store_.setCacheSize(compression_cache_size);
+
+  // out-of-core storage: spill the compressed images beyond the budget
+  double memory_budget;
+  std::string spill_dir;
+  int read_ahead;
+  if (!nh_private_.getParam ("compression/memory_budget", memory_budget))
+    memory_budget = 0.0;
+  if (!nh_private_.getParam ("compression/spill_dir", spill_dir))
+    spill_dir = "/tmp";
+  if (!nh_private_.getParam ("compression/read_ahead", read_ahead))
+    read_ahead = 4;
+  
+  if (memory_budget > 0.0)
+  {
+    if (!compress_keyframes_)
+    {
+      ROS_WARN("compression/memory_budget requires compressed keyframes, "
+        "enabling compress_keyframes");
+      compress_keyframes_ = true;
+    }
+    
+    size_t budget_bytes = memory_budget * 1024.0 * 1024.0;
+    if (!image_store_.setSpill(budget_bytes, spill_dir, read_ahead))
+      ROS_ERROR("Could not create the keyframe spill file in %s", spill_dir.c_str());
+  }
+  
+  map_thread_pool_.reset(new ThreadPool(map_threads_));
+
+  if (!nh_private_.getParam ("live_map", use_live_map_))
+    use_live_map_ = false;
+  if (!nh_private_.getParam ("map_rate", map_rate_))
+    map_rate_ = 0.2;
+  live_map_ = VoxelGridAccumulator(pcd_map_res_);
+
+  if (!nh_private_.getParam ("use_keyframe_bundles", use_keyframe_bundles_))
+    use_keyframe_bundles_ = false;
+  if (!nh_private_.getParam ("pending_queue_size", pending_queue_size_))
+    pending_queue_size_ = 5;
+  
+  double pose_buffer_duration;
+  if (!nh_private_.getParam ("pose_buffer_duration", pose_buffer_duration))
+    pose_buffer_duration = 2.0;
+  pose_buffer_.setDuration(pose_buffer_duration);
    
   // configure graph detection 
     
@@ -147,37 +269,176 @@ void KeyframeMapper::RGBDCallback(
   const ImageMsg::ConstPtr& depth_msg,
   const CameraInfoMsg::ConstPtr& info_msg)
 {
-  tf::StampedTransform transform;
+  PendingFrame pending;
+  pending.rgb_msg   = rgb_msg;
+  pending.depth_msg = depth_msg;
+  pending.info_msg  = info_msg;
+  
+  boost::mutex::scoped_lock lock(frames_mutex_);
+  
+  // park the frame until its pose arrives; make room by dropping
+  // the oldest frame if the odometry is lagging too far behind
+  if ((int)pending_frames_.size() >= pending_queue_size_)
+  {
+    pending_frames_.pop_front();
+    n_dropped_frames_++;
+    ROS_WARN_THROTTLE(2.0, 
+      "No pose received for the queued frames, dropping frames (%d total)", 
+      n_dropped_frames_);
+  }
+  
+  pending_frames_.push_back(pending);
+  processPendingFrames();
+}
 
-  const ros::Time& time = rgb_msg->header.stamp;
+void KeyframeMapper::keyframeBundleCallback(
+  const KeyframeBundle::ConstPtr& bundle_msg)
+{
+  // the image and info messages share the bundle buffer (no copies)
+  PendingFrame pending;
+  pending.rgb_msg   = ImageMsg::ConstPtr(bundle_msg, &bundle_msg->rgb);
+  pending.depth_msg = ImageMsg::ConstPtr(bundle_msg, &bundle_msg->depth);
+  pending.info_msg  = CameraInfoMsg::ConstPtr(bundle_msg, &bundle_msg->info);
+  
+  tf::Transform f2c;
+  tf::poseMsgToTF(bundle_msg->pose, f2c);
+  
+  boost::mutex::scoped_lock lock(frames_mutex_);
+  processMessages(pending, f2c);
+}
 
-  try{
-    tf_listener_.waitForTransform(
-     fixed_frame_, rgb_msg->header.frame_id, time, ros::Duration(0.1));
-    tf_listener_.lookupTransform(
-      fixed_frame_, rgb_msg->header.frame_id, time, transform);  
-  }
-  catch(...)
+void KeyframeMapper::odomCallback(const OdomMsg::ConstPtr& odom_msg)
+{
+  boost::mutex::scoped_lock lock(frames_mutex_);
+  
+  // the poses are of the odometry child frame: b2c is resolved for it
+  const std::string& child_frame = odom_msg->child_frame_id;
+  if (!child_frame.empty() && child_frame != odom_child_frame_)
   {
-    return;
+    if (tf::resolve("", child_frame) != tf::resolve("", base_frame_))
+      ROS_WARN_THROTTLE(5.0, "Odometry child frame %s does not match the "
+        "base frame %s", child_frame.c_str(), base_frame_.c_str());
+    
+    odom_child_frame_ = child_frame;
+    has_b2c_ = false;
+    pose_buffer_.clear();
   }
   
-  // create a new frame and increment the counter
-  rgbdtools::RGBDFrame frame;
-  createRGBDFrameFromROSMessages(rgb_msg, depth_msg, info_msg, frame); 
-  frame.index = rgbd_frame_index_;
-  rgbd_frame_index_++;
-  
-  bool result = processFrame(frame, eigenAffineFromTf(transform));
-  if (result) publishKeyframeData(keyframes_.size() - 1);
+  tf::Transform f2b;
+  tf::poseMsgToTF(odom_msg->pose.pose, f2b);
+  pose_buffer_.add(odom_msg->header.stamp, f2b);
   
-  publishPath();
+  processPendingFrames();
 }
 
+void KeyframeMapper::processPendingFrames()
+{
+  while (!pending_frames_.empty())
+  {
+    const PendingFrame& pending = pending_frames_.front();
+    
+    tf::Transform f2c;
+    PoseBuffer::LookupResult result = 
+      getCameraPose(pending.rgb_msg->header, f2c);
+    
+    // the oldest frame is still waiting: so are the newer ones
+    if (result == PoseBuffer::NOT_AVAILABLE) break;
+      
+    if (result == PoseBuffer::FOUND)
+    {
+      processMessages(pending, f2c);
+    }
+    else
+    {
+      n_dropped_frames_++;
+      ROS_WARN_THROTTLE(2.0, 
+        "Frame is older than the pose buffer, dropping frames (%d total)", 
+        n_dropped_frames_);
+    }
+    
+    pending_frames_.pop_front();
+  }
+}
 
+PoseBuffer::LookupResult KeyframeMapper::getCameraPose(
+  const std_msgs::Header& header, tf::Transform& f2c)
+{
+  // the base to camera transform is static: cache the latest one
+  if (!has_b2c_)
+  {
+    if (!tf_listener_.canTransform(odom_child_frame_, header.frame_id, ros::Time(0)))
+      return PoseBuffer::NOT_AVAILABLE;
+
+    tf::StampedTransform b2c;
+    try
+    {
+      tf_listener_.lookupTransform(
+        odom_child_frame_, header.frame_id, ros::Time(0), b2c);
+    }
+    catch (tf::TransformException& ex)
+    {
+      ROS_WARN("Base to camera transform unavailable %s", ex.what());
+      return PoseBuffer::NOT_AVAILABLE;
+    }
+    
+    b2c_ = b2c;
+    has_b2c_ = true;
+  }
+  
+  tf::Transform f2b;
+  PoseBuffer::LookupResult result = pose_buffer_.lookup(header.stamp, f2b);
+  if (result == PoseBuffer::FOUND) f2c = f2b * b2c_;
+  return result;
+}
+
+void KeyframeMapper::processMessages(
+  const PendingFrame& pending, 
+  const tf::Transform& f2c)
+{
+  AffineTransform pose = eigenAffineFromTf(f2c);
+  
+  // the keyframe decision only needs the pose: the images are 
+  // converted only for the (few) frames which become keyframes
+  bool result = processFrame(pending.rgb_msg->header, pose);
+  if (result) 
+  {
+    RGBDFramePtr frame = frame_builder_.acquire();
+    frame_builder_.build(
+      pending.rgb_msg, pending.depth_msg, pending.info_msg, *frame); 
+    frame->index = rgbd_frame_index_;
+    
+    addKeyframe(*frame, pose);
+    int kf_idx = keyframes_.size() - 1;
+    
+    publishKeyframeData(kf_idx);
+    if (use_live_map_) updateLiveMap(kf_idx);
+    if (use_live_octomap_) updateLiveOctomap(kf_idx);
+    
+    // the keyframe references the message buffers: keep them alive,
+    // unless the images are compressed (and the buffers not needed)
+    KeyframeMsgs msgs;
+    if (compress_keyframes_)
+    {
+      compressKeyframeImages(kf_idx);
+    }
+    else
+    {
+      msgs.rgb_msg   = pending.rgb_msg;
+      msgs.depth_msg = pending.depth_msg;
+    }
+    keyframe_msgs_.push_back(msgs);
+  }
+  
+  rgbd_frame_index_++;
+  
+  // the path grows with every frame: throttle the live updates
+  if (path_pub_.shouldPublish()) publishPath();
+  if (result && map_rate_ <= 0.0) publishMap();
+  if (result && octomap_rate_ <= 0.0) publishOctomapUpdate();
+}
 
 bool KeyframeMapper::processFrame(
-  const rgbdtools::RGBDFrame& frame, 
+  const std_msgs::Header& header, 
   const AffineTransform& pose)
 {
   // add the frame pose to the path vector
@@ -187,9 +448,8 @@ bool KeyframeMapper::processFrame(
  
   // update the header of the pose for the path
   frame_pose.header.frame_id = fixed_frame_;
-  frame_pose.header.seq = frame.header.seq;
-  frame_pose.header.stamp.sec = frame.header.stamp.sec;
-  frame_pose.header.stamp.nsec = frame.header.stamp.nsec;
+  frame_pose.header.seq = header.seq;
+  frame_pose.header.stamp = header.stamp;
     
   path_msg_.poses.push_back(frame_pose);
    
@@ -203,7 +463,7 @@ bool KeyframeMapper::processFrame(
   else
   {
     double dist, angle;
-    getTfDifference(tfFromEigenAffine(pose), 
+    getTfDifference(frame_tf, 
                     tfFromEigenAffine(keyframes_.back().pose), 
                     dist, angle);
 
@@ -213,10 +473,6 @@ bool KeyframeMapper::processFrame(
       result = false;
   }
 
-  if (result)
-  {
-    addKeyframe(frame, pose);
-  }
   return result;
 }
 
@@ -224,8 +480,15 @@ void KeyframeMapper::addKeyframe(
   const rgbdtools::RGBDFrame& frame, 
   const AffineTransform& pose)
 {
-  rgbdtools::RGBDKeyframe keyframe(frame);
-  keyframe.pose = pose;
+  // shallow copy of the images, instead of the deep copy 
+  // performed by the RGBDKeyframe(RGBDFrame) constructor
+  rgbdtools::RGBDKeyframe keyframe;
+  keyframe.header    = frame.header;
+  keyframe.index     = frame.index;
+  keyframe.intr      = frame.intr;
+  keyframe.rgb_img   = frame.rgb_img;
+  keyframe.depth_img = frame.depth_img;
+  keyframe.pose      = pose;
   
   if (manual_add_)
   {
@@ -236,6 +499,97 @@ void KeyframeMapper::addKeyframe(
   keyframes_.push_back(keyframe); 
 }
 
+void KeyframeMapper::compressKeyframeImages(int i)
+{
+  rgbdtools::RGBDKeyframe& keyframe = keyframes_[i];
+  
+  int index = image_store_.add(keyframe.rgb_img, keyframe.depth_img);
+  if (index != i)
+    ROS_ERROR("Keyframe image store out of sync (%d vs %d)", index, i);
+  
+  keyframe.rgb_img.release();
+  keyframe.depth_img.release();
+  
+  ROS_DEBUG("Compressed keyframe %d: %.1f MB in %d keyframes, %.1f MB in memory", 
+    i, image_store_.getCompressedBytes() / (1024.0 * 1024.0), 
+    image_store_.size(),
+    image_store_.getResidentBytes() / (1024.0 * 1024.0));
+}
+
+bool KeyframeMapper::decompressKeyframeImages(int i)
+{
+  rgbdtools::RGBDKeyframe& keyframe = keyframes_[i];
+  
+  if (!compress_keyframes_ || !keyframe.rgb_img.empty()) return false;
+  
+  return image_store_.get(i, keyframe.rgb_img, keyframe.depth_img);
+}
+
+void KeyframeMapper::releaseKeyframeImages(int i)
+{
+  keyframes_[i].rgb_img.release();
+  keyframes_[i].depth_img.release();
+}
+
+void KeyframeMapper::decompressAllKeyframeImages(std::vector<bool>& decompressed)
+{
+  decompressed.resize(keyframes_.size());
+  for (unsigned int kf_idx = 0; kf_idx < keyframes_.size(); ++kf_idx)
+    decompressed[kf_idx] = decompressKeyframeImages(kf_idx);
+}
+
+void KeyframeMapper::releaseAllKeyframeImages(const std::vector<bool>& decompressed)
+{
+  for (unsigned int kf_idx = 0; kf_idx < decompressed.size(); ++kf_idx)
+    if (decompressed[kf_idx]) releaseKeyframeImages(kf_idx);
+}
+
+/** @brief Path of a keyframe, in the layout of rgbdtools::saveKeyframes
+ * @param path the keyframes directory
+ * @param kf_idx the keyframe index
+ */
+static std::string getKeyframePath(const std::string& path, int kf_idx)
+{
+  std::stringstream ss_idx;
+  ss_idx << std::setw(4) << std::setfill('0') << kf_idx;
+  return path + "/" + ss_idx.str();
+}
+
+bool KeyframeMapper::saveAllKeyframes(const std::string& path)
+{
+  boost::system::error_code error;
+  boost::filesystem::create_directories(path, error);
+  if (error) return false;
+  
+  for (unsigned int kf_idx = 0; kf_idx < keyframes_.size(); ++kf_idx)
+  {
+    bool decompressed = decompressKeyframeImages(kf_idx);
+    bool result = rgbdtools::RGBDKeyframe::save(
+      keyframes_[kf_idx], getKeyframePath(path, kf_idx));
+    if (decompressed) releaseKeyframeImages(kf_idx);
+    
+    if (!result) return false;
+  }
+  
+  return true;
+}
+
+bool KeyframeMapper::loadAllKeyframes(const std::string& path)
+{
+  for (int kf_idx = 0; ; ++kf_idx)
+  {
+    std::string kf_path = getKeyframePath(path, kf_idx);
+    if (!boost::filesystem::exists(kf_path)) return true;
+    
+    ROS_INFO("Loading %s", kf_path.c_str());
+    rgbdtools::RGBDKeyframe keyframe;
+    if (!rgbdtools::RGBDKeyframe::load(keyframe, kf_path)) return false;
+    
+    keyframes_.push_back(keyframe);
+    if (compress_keyframes_) compressKeyframeImages(kf_idx);
+  }
+}
+
 bool KeyframeMapper::publishKeyframeSrvCallback(
   PublishKeyframe::Request& request,
   PublishKeyframe::Response& response)
@@ -291,11 +645,16 @@ bool KeyframeMapper::publishKeyframesSrvCallback(
 
 void KeyframeMapper::publishKeyframeData(int i)
 {
+  if (!keyframes_pub_.hasSubscribers()) return;
+
   rgbdtools::RGBDKeyframe& keyframe = keyframes_[i];
 
   // construct a cloud from the images
   PointCloudT cloud;
+  bool decompressed = decompressKeyframeImages(i);
+  if (keyframe.depth_img.empty()) return; // images unavailable
   keyframe.constructDensePointCloud(cloud, max_range_, max_stdev_);
+  if (decompressed) releaseKeyframeImages(i);
   
   // cloud transformed to the fixed frame
   PointCloudT cloud_ff; 
@@ -308,6 +667,8 @@ void KeyframeMapper::publishKeyframeData(int i)
 
 void KeyframeMapper::publishKeyframeAssociations()
 {
+  if (!kf_assoc_pub_.hasSubscribers()) return;
+
   visualization_msgs::Marker marker;
   marker.header.stamp = ros::Time::now();
   marker.header.frame_id = fixed_frame_;
@@ -369,6 +730,8 @@ void KeyframeMapper::publishKeyframeAssociations()
 
 void KeyframeMapper::publishKeyframePoses()
 {
+  if (!poses_pub_.hasSubscribers()) return;
+
   for(unsigned int kf_idx = 0; kf_idx < keyframes_.size(); ++kf_idx)
   {
     publishKeyframePose(kf_idx);
@@ -453,7 +816,7 @@ bool KeyframeMapper::saveKeyframesSrvCallback(
  
   ROS_INFO("Saving keyframes...");
   std::string filepath_keyframes = filepath + "/keyframes/";
-  bool result_kf = saveKeyframes(keyframes_, filepath_keyframes);
+  bool result_kf = saveAllKeyframes(filepath_keyframes);
   if (result_kf) ROS_INFO("Keyframes saved to %s", filepath.c_str());
   else ROS_ERROR("Keyframe saving failed!");
   
@@ -474,10 +837,22 @@ bool KeyframeMapper::loadKeyframesSrvCallback(
   
   ROS_INFO("Loading keyframes...");
   std::string filepath_keyframes = filepath + "/keyframes/";
-  bool result_kf = loadKeyframes(keyframes_, filepath_keyframes); 
+  keyframes_.clear();
+  keyframe_msgs_.clear();
+  image_store_.clear();
+  invalidateLiveMap();
+  bool result_kf = loadAllKeyframes(filepath_keyframes); 
   if (result_kf) ROS_INFO("Keyframes loaded successfully");
   else ROS_ERROR("Keyframe loading failed!");
   
+  keyframe_msgs_.resize(keyframes_.size());
+  
+  if (use_live_octomap_) 
+  {
+    resetLiveOctomap();
+    publishOctomapUpdate();
+  }
+  
   ROS_INFO("Loading path...");
   bool result_path = loadPath(filepath);
   if (result_path) ROS_INFO("Path loaded successfully");
@@ -528,7 +903,12 @@ bool KeyframeMapper::generateGraphSrvCallback(
   GenerateGraph::Response& response)
 {
   associations_.clear();
+  
+  // the graph detection needs all the images at once
+  std::vector<bool> decompressed;
+  decompressAllKeyframeImages(decompressed);
   graph_detector_.generateKeyframeAssociations(keyframes_, associations_);
+  releaseAllKeyframeImages(decompressed);
 
   ROS_INFO("%d associations detected", (int)associations_.size());
   
@@ -547,6 +927,23 @@ bool KeyframeMapper::solveGraphSrvCallback(
   // Graph solving: keyframe positions only, path is interpolated
   graph_solver_.solve(keyframes_, associations_);
   updatePathFromKeyframePoses();
+  
+  // move only the keyframes whose poses changed noticeably in the live maps
+  std::vector<int> moved;
+  if (use_live_map_)
+  {
+    findMovedKeyframes(live_map_poses_, moved);
+    ROS_INFO("Moving %d of %d keyframes in the live map", 
+      (int)moved.size(), (int)keyframes_.size());
+    reintegrateLiveMap(moved);
+  }
+  if (use_live_octomap_)
+  {
+    findMovedKeyframes(live_octomap_poses_, moved);
+    ROS_INFO("Moving %d of %d keyframes in the live Octomap", 
+      (int)moved.size(), (int)keyframes_.size());
+    reintegrateLiveOctomap(moved);
+  }
     
   // Graph solving: keyframe positions and VO path
   /*
@@ -563,6 +960,8 @@ bool KeyframeMapper::solveGraphSrvCallback(
   publishPath();
   publishKeyframePoses();
   publishKeyframeAssociations();
+  publishMap();
+  publishOctomapUpdate();
 
   return true;
 }
@@ -679,32 +1078,121 @@ bool KeyframeMapper::savePcdMap(const std::string& path)
 
 void KeyframeMapper::buildPcdMap(PointCloudT& map_cloud)
 {
-  PointCloudT::Ptr aggregate_cloud(new PointCloudT());
-  aggregate_cloud->header.frame_id = fixed_frame_;
+  if (use_live_map_)
+  {
+    boost::mutex::scoped_lock lock(live_map_mutex_);
+    if (live_map_valid_)
+    {
+      live_map_.getCloud(map_cloud);
+      map_cloud.header.frame_id = fixed_frame_;
+      return;
+    }
+  }
 
-  // aggregate all frames into single cloud
-  for (unsigned int kf_idx = 0; kf_idx < keyframes_.size(); ++kf_idx)
+  // split the keyframes into more ranges than threads, for load balancing
+  int n_keyframes = keyframes_.size();
+  int n_chunks = std::min(n_keyframes, 4 * (map_thread_pool_->getNumThreads() + 1));
+  n_chunks = std::max(n_chunks, 1);
+  int chunk_size = (n_keyframes + n_chunks - 1) / n_chunks;
+
+  // voxelize (and filter for max z) each range into its own grid, 
+  // instead of aggregating all the dense clouds first
+  std::vector<VoxelGridAccumulator> grids(
+    n_chunks, VoxelGridAccumulator(pcd_map_res_));
+  map_thread_pool_->run(n_chunks, boost::bind(
+    &KeyframeMapper::buildPcdMapChunk, this, _1, chunk_size, &grids));
+
+  // merge the grids
+  for (int chunk = 1; chunk < n_chunks; ++chunk)
+  {
+    grids[0].merge(grids[chunk]);
+    grids[chunk] = VoxelGridAccumulator(pcd_map_res_);
+  }
+
+  grids[0].getCloud(map_cloud);
+  map_cloud.header.frame_id = fixed_frame_;
+  
+  // the rebuilt map is up to date again: keep it
+  if (use_live_map_)
+  {
+    boost::mutex::scoped_lock lock(live_map_mutex_);
+    live_map_.swap(grids[0]);
+    live_map_valid_ = true;
+    
+    live_map_poses_.clear();
+    for (int kf_idx = 0; kf_idx < n_keyframes; ++kf_idx)
+      live_map_poses_.push_back(keyframes_[kf_idx].pose);
+  }
+}
+
+void KeyframeMapper::buildPcdMapChunk(
+  int chunk, int chunk_size,
+  std::vector<VoxelGridAccumulator>* grids)
+{
+  VoxelGridAccumulator& grid = (*grids)[chunk];
+
+  int begin = chunk * chunk_size;
+  int end = std::min(begin + chunk_size, (int)keyframes_.size());
+
+  for (int kf_idx = begin; kf_idx < end; ++kf_idx)
   {
     const rgbdtools::RGBDKeyframe& keyframe = keyframes_[kf_idx];
     
     PointCloudT cloud;   
+    bool decompressed = decompressKeyframeImages(kf_idx);
+    if (keyframe.depth_img.empty()) continue; // images unavailable
     keyframe.constructDensePointCloud(cloud, max_range_, max_stdev_);
+    if (decompressed) releaseKeyframeImages(kf_idx);
 
-    PointCloudT cloud_tf;
-    pcl::transformPointCloud(cloud, cloud_tf, keyframe.pose);
-    cloud_tf.header.frame_id = fixed_frame_;
-
-    *aggregate_cloud += cloud_tf;
+    grid.add(cloud, keyframe.pose, max_map_z_);
   }
+}
+
+void KeyframeMapper::updateLiveMap(int i)
+{
+  const rgbdtools::RGBDKeyframe& keyframe = keyframes_[i];
+  
+  boost::mutex::scoped_lock lock(live_map_mutex_);
+  
+  // an outdated map is rebuilt from all the keyframes anyway
+  if (!live_map_valid_) return;
+  
+  PointCloudT cloud;
+  keyframe.constructDensePointCloud(cloud, max_range_, max_stdev_);
+  live_map_.add(cloud, keyframe.pose, max_map_z_);
+  live_map_poses_.push_back(keyframe.pose);
+  live_map_dirty_ = true;
+}
 
-  // filter cloud using voxel grid, and for max z
-  pcl::VoxelGrid<PointT> vgf;
-  vgf.setInputCloud(aggregate_cloud);
-  vgf.setLeafSize(pcd_map_res_, pcd_map_res_, pcd_map_res_);
-  vgf.setFilterFieldName("z");
-  vgf.setFilterLimits (-std::numeric_limits<double>::infinity(), max_map_z_);
+void KeyframeMapper::invalidateLiveMap()
+{
+  boost::mutex::scoped_lock lock(live_map_mutex_);
+  live_map_.clear();
+  live_map_poses_.clear();
+  live_map_valid_ = false;
+  live_map_dirty_ = true;
+}
 
-  vgf.filter(map_cloud);
+void KeyframeMapper::mapTimerCallback(const ros::TimerEvent& event)
+{
+  publishMap();
+}
+
+void KeyframeMapper::publishMap()
+{
+  // without the live map, every update is a full rebuild
+  if (!use_live_map_ || !map_pub_.hasSubscribers()) return;
+  
+  // the last map is latched: only publish changes
+  {
+    boost::mutex::scoped_lock lock(live_map_mutex_);
+    if (!live_map_dirty_) return;
+    live_map_dirty_ = false;
+  }
+  
+  PointCloudT map_cloud;
+  buildPcdMap(map_cloud);
+  map_pub_.publish(map_cloud);
 }
 
 bool KeyframeMapper::saveOctomap(const std::string& path)
@@ -727,32 +1215,195 @@ bool KeyframeMapper::saveOctomap(const std::string& path)
   return result;
 }
 
+/** @brief Applies the cells updated by a scan to an octree, as 
+ * insertPointCloud does, or reverts them
+ * @param tree the octree
+ * @param free_cells cells traversed by the rays
+ * @param occupied_cells cells at the ray endpoints
+ * @param revert whether to revert the updates of an earlier insertion
+ * @param lazy_eval whether to skip updating the inner nodes
+ */
+template <class TreeT>
+static void applyOctomapScan(
+  TreeT& tree,
+  const octomap::KeySet& free_cells,
+  const octomap::KeySet& occupied_cells,
+  bool revert,
+  bool lazy_eval)
+{
+  octomap::KeySet::const_iterator it;
+  
+  if (!revert)
+  {
+    for (it = free_cells.begin(); it != free_cells.end(); ++it)
+      tree.updateNode(*it, false, lazy_eval);
+    for (it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
+      tree.updateNode(*it, true, lazy_eval);
+  }
+  else
+  {
+    for (it = free_cells.begin(); it != free_cells.end(); ++it)
+      tree.updateNode(*it, -tree.getProbMissLog(), lazy_eval);
+    for (it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
+      tree.updateNode(*it, -tree.getProbHitLog(), lazy_eval);
+  }
+}
+
 void KeyframeMapper::buildOctomap(octomap::OcTree& tree)
 {
   ROS_INFO("Building Octomap...");
   
-  octomap::point3d sensor_origin(0.0, 0.0, 0.0);  
-
-  for (unsigned int kf_idx = 0; kf_idx < keyframes_.size(); ++kf_idx)
+  int n_keyframes = keyframes_.size();
+  
+  if (!octomap_parallel_)
   {
-    ROS_INFO("Processing keyframe %u", kf_idx);
-    const rgbdtools::RGBDKeyframe& keyframe = keyframes_[kf_idx];
+    for (int kf_idx = 0; kf_idx < n_keyframes; ++kf_idx)
+    {
+      ROS_INFO("Processing keyframe %d", kf_idx);
+      
+      octomap::Pointcloud scan;
+      octomap::point3d origin;
+      if (!buildOctomapScan(kf_idx, keyframes_[kf_idx].pose, scan, origin)) continue;
+      
+      tree.insertPointCloud(scan, origin, octomap_max_range_, octomap_lazy_eval_);
+    }
+  }
+  else
+  {
+    // the ray casting of a batch of keyframes runs in parallel, then the 
+    // updates are applied in keyframe order, as insertPointCloud would.
+    // The batches bound the memory used by the key sets.
+    int batch_size = 2 * (map_thread_pool_->getNumThreads() + 1);
+    std::vector<OctomapScanUpdate> updates;
+    AffineTransformVector poses;
     
-    PointCloudT cloud;
-    keyframe.constructDensePointCloud(cloud, max_range_, max_stdev_);
-           
-    octomap::pose6d frame_origin = poseTfToOctomap(tfFromEigenAffine(keyframe.pose));
-
-    // build octomap cloud from pcl cloud
-    octomap::Pointcloud octomap_cloud;
-    for (unsigned int pt_idx = 0; pt_idx < cloud.points.size(); ++pt_idx)
+    for (int first = 0; first < n_keyframes; first += batch_size)
     {
-      const PointT& p = cloud.points[pt_idx];
-      if (!std::isnan(p.z))
-        octomap_cloud.push_back(p.x, p.y, p.z);
+      int n_tasks = std::min(batch_size, n_keyframes - first);
+      ROS_INFO("Processing keyframes %d to %d", first, first + n_tasks - 1);
+      
+      updates.clear();
+      updates.resize(n_tasks);
+      poses.clear();
+      for (int task = 0; task < n_tasks; ++task)
+      {
+        updates[task].keyframe = first + task;
+        poses.push_back(keyframes_[first + task].pose);
+      }
+      
+      map_thread_pool_->run(n_tasks, boost::bind(
+        &KeyframeMapper::computeOctomapUpdate, this, 
+        _1, &tree, &poses, false, &updates));
+      
+      for (int task = 0; task < n_tasks; ++task)
+      {
+        const OctomapScanUpdate& update = updates[task];
+        applyOctomapScan(tree, update.free_cells, update.occupied_cells, 
+                         false, octomap_lazy_eval_);
+      }
     }
+  }
+  
+  if (octomap_lazy_eval_)
+  {
+    tree.updateInnerOccupancy();
+    tree.prune();
+  }
+}
+
+bool KeyframeMapper::buildOctomapScan(
+  int i, 
+  const AffineTransform& pose,
+  octomap::Pointcloud& scan, 
+  octomap::point3d& origin)
+{
+  const rgbdtools::RGBDKeyframe& keyframe = keyframes_[i];
+  
+  PointCloudT cloud;
+  bool decompressed = decompressKeyframeImages(i);
+  if (keyframe.depth_img.empty()) return false; // images unavailable
+  keyframe.constructDensePointCloud(cloud, max_range_, max_stdev_);
+  if (decompressed) releaseKeyframeImages(i);
+  
+  // build octomap cloud from pcl cloud
+  scan.reserve(cloud.points.size());
+  for (unsigned int pt_idx = 0; pt_idx < cloud.points.size(); ++pt_idx)
+  {
+    const PointT& p = cloud.points[pt_idx];
+    if (!std::isnan(p.z))
+      scan.push_back(p.x, p.y, p.z);
+  }
+  
+  // to the fixed frame, as insertScan does with the frame origin
+  octomap::pose6d frame_origin = poseTfToOctomap(tfFromEigenAffine(pose));
+  scan.transform(frame_origin);
+  origin = frame_origin.trans();
+  
+  return true;
+}
+
+void KeyframeMapper::computeOctomapUpdate(
+  int task, 
+  const octomap::OcTree* tree,
+  const AffineTransformVector* poses,
+  bool color,
+  std::vector<OctomapScanUpdate>* updates)
+{
+  OctomapScanUpdate& update = (*updates)[task];
+  const AffineTransform& pose = (*poses)[task];
+  
+  octomap::Pointcloud scan;
+  octomap::point3d origin;
+  
+  bool result;
+  if (color) 
+    result = buildColorOctomapScan(
+      update.keyframe, pose, *tree, scan, origin, 
+      update.collect_colors ? &update.colors : NULL);
+  else
+    result = buildOctomapScan(update.keyframe, pose, scan, origin);
+  
+  if (result) castOctomapScan(*tree, scan, origin, update);
+}
+
+void KeyframeMapper::castOctomapScan(
+  const octomap::OcTree& tree,
+  const octomap::Pointcloud& scan,
+  const octomap::point3d& origin,
+  OctomapScanUpdate& update)
+{
+  octomap::KeyRay keyray;
+  for (unsigned int pt_idx = 0; pt_idx < scan.size(); ++pt_idx)
+  {
+    const octomap::point3d& p = scan[pt_idx];
     
-    tree.insertScan(octomap_cloud, sensor_origin, frame_origin);
+    if (octomap_max_range_ < 0.0 || (p - origin).norm() <= octomap_max_range_)
+    {
+      if (tree.computeRayKeys(origin, p, keyray))
+        update.free_cells.insert(keyray.begin(), keyray.end());
+      
+      octomap::OcTreeKey key;
+      if (tree.coordToKeyChecked(p, key))
+        update.occupied_cells.insert(key);
+    }
+    else
+    {
+      // truncated ray: free space only
+      octomap::point3d direction = (p - origin).normalized();
+      octomap::point3d end = origin + direction * (float)octomap_max_range_;
+      if (tree.computeRayKeys(origin, end, keyray))
+        update.free_cells.insert(keyray.begin(), keyray.end());
+    }
+  }
+  
+  // occupied cells take precedence over free ones
+  octomap::KeySet::iterator it = update.free_cells.begin();
+  while (it != update.free_cells.end())
+  {
+    if (update.occupied_cells.find(*it) != update.occupied_cells.end())
+      update.free_cells.erase(it++);
+    else
+      ++it;
   }
 }
 
@@ -760,61 +1411,418 @@ void KeyframeMapper::buildColorOctomap(octomap::ColorOcTree& tree)
 {
   ROS_INFO("Building Octomap with color...");
 
-  octomap::point3d sensor_origin(0.0, 0.0, 0.0);  
+  // colors of all the points, by leaf
+  ColorSumMap colors;
+  
+  // the keys only depend on the resolution
+  octomap::OcTree key_tree(tree.getResolution());
 
   for (unsigned int kf_idx = 0; kf_idx < keyframes_.size(); ++kf_idx)
   {
     ROS_INFO("Processing keyframe %u", kf_idx);
+    
+    octomap::Pointcloud scan;
+    octomap::point3d origin;
+    if (!buildColorOctomapScan(
+          kf_idx, keyframes_[kf_idx].pose, key_tree, scan, origin, &colors)) 
+      continue;
+    
+    // insert scan (only xyz considered, no colors); the inner nodes
+    // are updated once, after all the keyframes
+    tree.insertPointCloud(scan, origin, octomap_max_range_, true);
+  }
+  
+  // insert the average colors
+  for (ColorSumMap::const_iterator it = colors.begin(); it != colors.end(); ++it)
+  {
+    const ColorSum& c = it->second;
+    tree.setNodeColor(it->first, c.r / c.n, c.g / c.n, c.b / c.n);
+  }
+  
+  // propagates the occupancy and the colors to the inner nodes
+  tree.updateInnerOccupancy();
+  tree.prune();
+}
+
+bool KeyframeMapper::buildColorOctomapScan(
+  int i, 
+  const AffineTransform& pose,
+  const octomap::OcTree& tree,
+  octomap::Pointcloud& scan, 
+  octomap::point3d& origin,
+  ColorSumMap* colors)
+{
+  const rgbdtools::RGBDKeyframe& keyframe = keyframes_[i];
+     
+  // construct the cloud
+  PointCloudT cloud;
+  bool decompressed = decompressKeyframeImages(i);
+  if (keyframe.depth_img.empty()) return false; // images unavailable
+  keyframe.constructDensePointCloud(cloud, max_range_, max_stdev_);
+  if (decompressed) releaseKeyframeImages(i);
+
+  // single pass: transform to the fixed frame, filter for max z, 
+  // and accumulate the colors by leaf key
+  scan.reserve(cloud.points.size());
+  for (unsigned int pt_idx = 0; pt_idx < cloud.points.size(); ++pt_idx)
+  {
+    const PointT& p = cloud.points[pt_idx];
+    if (std::isnan(p.z)) continue;
+    
+    Eigen::Vector3f q = pose * Eigen::Vector3f(p.x, p.y, p.z);
+    if (q.z() > max_map_z_) continue;
+    
+    octomap::point3d endpoint(q.x(), q.y(), q.z());
+    scan.push_back(endpoint);
+    
+    octomap::OcTreeKey key;
+    if (!colors || !tree.coordToKeyChecked(endpoint, key)) continue;
+    
+    std::pair<ColorSumMap::iterator, bool> result = 
+      colors->insert(std::make_pair(key, ColorSum()));
+    ColorSum& c = result.first->second;
+    if (result.second) c.r = c.g = c.b = c.n = 0;
+    c.r += p.r; c.g += p.g; c.b += p.b;
+    c.n++;
+  }
+  
+  Eigen::Vector3f t = pose.translation();
+  origin = octomap::point3d(t.x(), t.y(), t.z());
+  
+  return true;
+}
+
+void KeyframeMapper::resetLiveOctomap()
+{
+  boost::mutex::scoped_lock lock(live_octomap_mutex_);
+  
+  ROS_INFO("Rebuilding the live Octomap");
+  
+  // The next update only flags the reset: subscribers fetch the new 
+  // tree with get_octomap. The live tree is not clamped (thresholds at 
+  // probability 0 and 1), so that the scans of moved keyframes can be 
+  // reverted exactly. Pruning is lossless.
+  if (octomap_with_color_)
+  {
+    live_color_octree_.reset(new octomap::ColorOcTree(octomap_res_));
+    live_color_octree_->setClampingThresMin(0.0);
+    live_color_octree_->setClampingThresMax(1.0);
+    buildColorOctomap(*live_color_octree_);
+  }
+  else
+  {
+    live_octree_.reset(new octomap::OcTree(octomap_res_));
+    live_octree_->setClampingThresMin(0.0);
+    live_octree_->setClampingThresMax(1.0);
+    buildOctomap(*live_octree_);
+  }
+  
+  live_octomap_poses_.clear();
+  for (unsigned int kf_idx = 0; kf_idx < keyframes_.size(); ++kf_idx)
+    live_octomap_poses_.push_back(keyframes_[kf_idx].pose);
+  
+  live_octomap_changes_.clear();
+  live_octomap_reset_ = true;
+}
+
+void KeyframeMapper::updateLiveOctomap(int i)
+{
+  const AffineTransform& pose = keyframes_[i].pose;
+  
+  boost::mutex::scoped_lock lock(live_octomap_mutex_);
+  
+  live_octomap_poses_.push_back(pose);
+  
+  // the keys only depend on the resolution
+  octomap::OcTree key_tree(octomap_res_);
+  
+  octomap::Pointcloud scan;
+  octomap::point3d origin;
+  OctomapScanUpdate update;
+  update.keyframe = i;
+  
+  if (octomap_with_color_)
+  {
+    if (!buildColorOctomapScan(i, pose, key_tree, scan, origin, &update.colors)) 
+      return;
+  }
+  else
+  {
+    if (!buildOctomapScan(i, pose, scan, origin)) return;
+  }
+  
+  // ray cast here rather than with insertPointCloud, so that the 
+  // touched cells are known
+  castOctomapScan(key_tree, scan, origin, update);
+  
+  // the inner nodes are only updated (and pruned) for snapshots
+  if (octomap_with_color_)
+  {
+    octomap::ColorOcTree& tree = *live_color_octree_;
+    applyOctomapScan(tree, update.free_cells, update.occupied_cells, false, true);
+    
+    // blend the average colors of the keyframe with the existing ones
+    const ColorSumMap& colors = update.colors;
+    for (ColorSumMap::const_iterator it = colors.begin(); it != colors.end(); ++it)
+    {
+      const ColorSum& c = it->second;
+      tree.averageNodeColor(it->first, c.r / c.n, c.g / c.n, c.b / c.n);
+    }
+  }
+  else
+  {
+    octomap::OcTree& tree = *live_octree_;
+    applyOctomapScan(tree, update.free_cells, update.occupied_cells, false, true);
+  }
+  
+  trackOctomapChanges(update);
+}
+
+void KeyframeMapper::findMovedKeyframes(
+  const AffineTransformVector& map_poses,
+  std::vector<int>& moved)
+{
+  moved.clear();
+  
+  int n = std::min(map_poses.size(), keyframes_.size());
+  for (int kf_idx = 0; kf_idx < n; ++kf_idx)
+  {
+    AffineTransform delta = map_poses[kf_idx].inverse() * keyframes_[kf_idx].pose;
+    if (tfGreaterThan(tfFromEigenAffine(delta), 
+                      reintegration_dist_eps_, reintegration_angle_eps_))
+      moved.push_back(kf_idx);
+  }
+}
+
+void KeyframeMapper::reintegrateLiveMap(const std::vector<int>& moved)
+{
+  boost::mutex::scoped_lock lock(live_map_mutex_);
+  
+  // an outdated map is rebuilt from all the keyframes anyway
+  if (!live_map_valid_) return;
+  
+  for (unsigned int i = 0; i < moved.size(); ++i)
+  {
+    int kf_idx = moved[i];
     const rgbdtools::RGBDKeyframe& keyframe = keyframes_[kf_idx];
-       
-    // construct the cloud
-    PointCloudT::Ptr cloud_unf(new PointCloudT());
-    keyframe.constructDensePointCloud(*cloud_unf, max_range_, max_stdev_);
-  
-    // perform filtering for max z
-    pcl::transformPointCloud(*cloud_unf, *cloud_unf, keyframe.pose);
-    PointCloudT cloud;
-    pcl::PassThrough<PointT> pass;
-    pass.setInputCloud (cloud_unf);
-    pass.setFilterFieldName ("z");
-    pass.setFilterLimits (-std::numeric_limits<double>::infinity(), max_map_z_);
-    pass.filter(cloud);
-    pcl::transformPointCloud(cloud, cloud, keyframe.pose.inverse());
-    
-    octomap::pose6d frame_origin = poseTfToOctomap(tfFromEigenAffine(keyframe.pose));
-    
-    // build octomap cloud from pcl cloud
-    octomap::Pointcloud octomap_cloud;
-    for (unsigned int pt_idx = 0; pt_idx < cloud.points.size(); ++pt_idx)
+    
+    PointCloudT cloud;   
+    bool decompressed = decompressKeyframeImages(kf_idx);
+    if (keyframe.depth_img.empty()) continue; // images unavailable
+    keyframe.constructDensePointCloud(cloud, max_range_, max_stdev_);
+    if (decompressed) releaseKeyframeImages(kf_idx);
+    
+    live_map_.remove(cloud, live_map_poses_[kf_idx], max_map_z_);
+    live_map_.add(cloud, keyframe.pose, max_map_z_);
+    live_map_poses_[kf_idx] = keyframe.pose;
+    live_map_dirty_ = true;
+  }
+}
+
+void KeyframeMapper::reintegrateLiveOctomap(const std::vector<int>& moved)
+{
+  boost::mutex::scoped_lock lock(live_octomap_mutex_);
+  
+  // the keys only depend on the resolution
+  octomap::OcTree key_tree(octomap_res_);
+  
+  // each keyframe has two updates: the scan at the old pose (to revert)
+  // and at the new pose. They are computed in parallel, in batches.
+  int batch_size = 2 * (map_thread_pool_->getNumThreads() + 1);
+  std::vector<OctomapScanUpdate> updates;
+  AffineTransformVector poses;
+  
+  for (unsigned int first = 0; first < moved.size(); first += batch_size)
+  {
+    int n_keyframes = std::min((int)(moved.size() - first), batch_size);
+    
+    updates.clear();
+    updates.resize(2 * n_keyframes);
+    poses.clear();
+    for (int i = 0; i < n_keyframes; ++i)
     {
-      const PointT& p = cloud.points[pt_idx];
-      if (!std::isnan(p.z))
-        octomap_cloud.push_back(p.x, p.y, p.z);
+      int kf_idx = moved[first + i];
+      updates[2 * i    ].keyframe = kf_idx;
+      updates[2 * i + 1].keyframe = kf_idx;
+      updates[2 * i + 1].collect_colors = true; // colors are not reverted
+      poses.push_back(live_octomap_poses_[kf_idx]);
+      poses.push_back(keyframes_[kf_idx].pose);
     }
     
-    // insert scan (only xyz considered, no colors)
-    tree.insertScan(octomap_cloud, sensor_origin, frame_origin);
+    map_thread_pool_->run(2 * n_keyframes, boost::bind(
+      &KeyframeMapper::computeOctomapUpdate, this, 
+      _1, &key_tree, &poses, octomap_with_color_, &updates));
     
-    // insert colors
-    PointCloudT cloud_tf;
-    pcl::transformPointCloud(cloud, cloud_tf, keyframe.pose);
-    for (unsigned int pt_idx = 0; pt_idx < cloud_tf.points.size(); ++pt_idx)
+    for (int i = 0; i < n_keyframes; ++i)
     {
-      const PointT& p = cloud_tf.points[pt_idx];
-      if (!std::isnan(p.z))
+      const OctomapScanUpdate& old_update = updates[2 * i];
+      const OctomapScanUpdate& new_update = updates[2 * i + 1];
+      
+      if (octomap_with_color_)
       {
-        octomap::point3d endpoint(p.x, p.y, p.z);
-        octomap::ColorOcTreeNode* n = tree.search(endpoint);
-        if (n) n->setColor(p.r, p.g, p.b); 
+        octomap::ColorOcTree& tree = *live_color_octree_;
+        applyOctomapScan(tree, old_update.free_cells, old_update.occupied_cells, 
+                         true, true);
+        applyOctomapScan(tree, new_update.free_cells, new_update.occupied_cells, 
+                         false, true);
+        
+        const ColorSumMap& colors = new_update.colors;
+        for (ColorSumMap::const_iterator it = colors.begin(); it != colors.end(); ++it)
+        {
+          const ColorSum& c = it->second;
+          tree.averageNodeColor(it->first, c.r / c.n, c.g / c.n, c.b / c.n);
+        }
       }
+      else
+      {
+        octomap::OcTree& tree = *live_octree_;
+        applyOctomapScan(tree, old_update.free_cells, old_update.occupied_cells, 
+                         true, true);
+        applyOctomapScan(tree, new_update.free_cells, new_update.occupied_cells, 
+                         false, true);
+      }
+      
+      trackOctomapChanges(old_update);
+      trackOctomapChanges(new_update);
+      
+      live_octomap_poses_[new_update.keyframe] = keyframes_[new_update.keyframe].pose;
+    }
+  }
+}
+
+/** @brief Appends the color of a leaf to an Octomap update. 
+ * No-op for leaves without color.
+ */
+static void appendLeafColor(const octomap::OcTreeNode* node, OctomapUpdate& update) { }
+
+static void appendLeafColor(const octomap::ColorOcTreeNode* node, OctomapUpdate& update)
+{
+  octomap::ColorOcTreeNode::Color color = node->getColor();
+  update.colors.push_back(color.r);
+  update.colors.push_back(color.g);
+  update.colors.push_back(color.b);
+}
+
+/** @brief Appends leaves of an octree to an Octomap update
+ * @param tree the octree
+ * @param keys the keys of the leaves
+ * @param update the update
+ */
+template <class TreeT>
+static void appendOctomapLeaves(
+  const TreeT& tree, 
+  const octomap::KeySet& keys, 
+  OctomapUpdate& update)
+{
+  update.resolution = tree.getResolution();
+  
+  for (octomap::KeySet::const_iterator it = keys.begin(); it != keys.end(); ++it)
+  {
+    const octomap::OcTreeKey& key = *it;
+    
+    // leaves which were pruned are found at the depth of their parent
+    const typename TreeT::NodeType* node = tree.search(key);
+    if (!node) continue;
+    
+    update.keys.push_back(key[0]);
+    update.keys.push_back(key[1]);
+    update.keys.push_back(key[2]);
+    update.log_odds.push_back(node->getLogOdds());
+    appendLeafColor(node, update);
+  }
+}
+
+void KeyframeMapper::trackOctomapChanges(const OctomapScanUpdate& update)
+{
+  // without subscribers, the changes need not be tracked
+  if (!octomap_updates_pub_.hasSubscribers()) return;
+  
+  live_octomap_changes_.insert(
+    update.free_cells.begin(), update.free_cells.end());
+  live_octomap_changes_.insert(
+    update.occupied_cells.begin(), update.occupied_cells.end());
+  
+  // colors are also blended into leaves beyond the max. range
+  for (ColorSumMap::const_iterator it = update.colors.begin(); 
+       it != update.colors.end(); ++it)
+    live_octomap_changes_.insert(it->first);
+}
+
+void KeyframeMapper::octomapTimerCallback(const ros::TimerEvent& event)
+{
+  publishOctomapUpdate();
+}
+
+void KeyframeMapper::publishOctomapUpdate()
+{
+  if (!use_live_octomap_ || !octomap_updates_pub_.hasSubscribers()) return;
+  
+  OctomapUpdate::Ptr update(new OctomapUpdate());
+  update->header.stamp = ros::Time::now();
+  update->header.frame_id = fixed_frame_;
+  
+  boost::mutex::scoped_lock lock(live_octomap_mutex_);
+  
+  if (!live_octomap_reset_ && live_octomap_changes_.empty()) return;
+  
+  // after a reset, the subscribers fetch the whole octree instead
+  if (live_octomap_reset_)
+    update->resolution = octomap_res_;
+  else if (octomap_with_color_) 
+    appendOctomapLeaves(*live_color_octree_, live_octomap_changes_, *update);
+  else
+    appendOctomapLeaves(*live_octree_, live_octomap_changes_, *update);
+  
+  update->reset = live_octomap_reset_;
+  live_octomap_reset_ = false;
+  live_octomap_changes_.clear();
+  
+  octomap_updates_pub_.publish(update);
+}
+
+bool KeyframeMapper::getOctomapSrvCallback(
+  GetOctomap::Request& request,
+  GetOctomap::Response& response)
+{
+  if (!use_live_octomap_)
+  {
+    ROS_WARN("The live Octomap is disabled (live_octomap parameter)");
+    return false;
+  }
+  
+  std::stringstream stream;
+  {
+    boost::mutex::scoped_lock lock(live_octomap_mutex_);
+    
+    // the live tree is updated lazily
+    const octomap::AbstractOccupancyOcTree* tree;
+    if (octomap_with_color_) 
+    {
+      live_color_octree_->updateInnerOccupancy();
+      live_color_octree_->prune();
+      tree = live_color_octree_.get();
+    }
+    else 
+    {
+      live_octree_->updateInnerOccupancy();
+      live_octree_->prune();
+      tree = live_octree_.get();
     }
     
-    tree.updateInnerOccupancy();
+    response.resolution = tree->getResolution();
+    if (!tree->writeBinaryConst(stream)) return false;
   }
+  
+  const std::string& data = stream.str();
+  response.data.assign(data.begin(), data.end());
+  
+  return true;
 }
 
 void KeyframeMapper::publishPath()
 {
+  if (!path_pub_.hasSubscribers()) return;
+
   path_msg_.header.frame_id = fixed_frame_; 
   path_pub_.publish(path_msg_);
 }
@@ -45,6 +45,8 @@ RGBDImageProc::RGBDImageProc(
     verbose_ = false;
   if (!nh_private_.getParam("publish_cloud", publish_cloud_))
     publish_cloud_ = true;
+  if (!nh_private_.getParam("cloud_rate", cloud_rate_))
+    cloud_rate_ = 0.0;
   if (!nh_private_.getParam("calib_path", calib_path_))
   {
     std::string home_path = getenv("HOME");
@@ -75,8 +77,8 @@ RGBDImageProc::RGBDImageProc(
     "rgbd/info", queue_size_);
 
   if(publish_cloud_)
-    cloud_publisher_ = nh_.advertise<PointCloudT>(
-          "rgbd/cloud", queue_size_);
+    cloud_publisher_.advertise<PointCloudT>(
+          nh_, "rgbd/cloud", queue_size_, cloud_rate_);
 
   // dynamic reconfigure
   ProcConfigServer::CallbackType f = boost::bind(&RGBDImageProc::reconfigCallback, this, _1, _2);
@@ -290,8 +292,8 @@ void RGBDImageProc::RGBDCallback(
     intr_rect_depth_, intr_rect_rgb_, ir2rgb_, depth_img_rect, depth_img_rect_reg);
   dur_reproject = getMsDuration(start_reproject);
 
-  // **** point cloud
-  if (publish_cloud_)
+  // **** point cloud (only built if somebody is listening)
+  if (publish_cloud_ && cloud_publisher_.shouldPublish())
   {
     ros::WallTime start_cloud = ros::WallTime::now();
     PointCloudT::Ptr cloud_ptr;
@@ -319,6 +321,10 @@ void RGBDImageProc::RGBDCallback(
   // **** update camera info (single, since both images are in rgb frame)
   rgb_rect_info_msg_.header = rgb_info_msg->header;
   
+  // published as a pointer, so in-process subscribers avoid a copy
+  CameraInfoMsg::Ptr info_out_msg = 
+    boost::make_shared<CameraInfoMsg>(rgb_rect_info_msg_);
+  
   dur_allocate = getMsDuration(start_allocate); 
 
   // **** print diagnostics
@@ -333,7 +339,7 @@ void RGBDImageProc::RGBDCallback(
   // **** publish
   rgb_publisher_.publish(rgb_out_msg);
   depth_publisher_.publish(depth_out_msg);
-  info_publisher_.publish(rgb_rect_info_msg_);
+  info_publisher_.publish(info_out_msg);
 }
 
 void RGBDImageProc::reconfigCallback(ProcConfig& config, uint32_t level)
@@ -343,8 +349,8 @@ void RGBDImageProc::reconfigCallback(ProcConfig& config, uint32_t level)
       publish_cloud_ = config.publish_cloud;
   if(!old_publish_cloud && publish_cloud_)
   {
-    cloud_publisher_ = nh_.advertise<PointCloudT>(
-        "rgbd/cloud", queue_size_);
+    cloud_publisher_.advertise<PointCloudT>(
+        nh_, "rgbd/cloud", queue_size_, cloud_rate_);
   }
   else
   {
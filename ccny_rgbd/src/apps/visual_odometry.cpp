@@ -31,7 +31,10 @@ VisualOdometry::VisualOdometry(
   nh_(nh), 
   nh_private_(nh_private),
   initialized_(false),
-  frame_count_(0)
+  frame_count_(0),
+  n_dropped_frames_(0),
+  stats_frame_count_(0),
+  stats_n_model_pts_(0)
 {
   ROS_INFO("Starting RGBD Visual Odometry");
 
@@ -42,6 +45,10 @@ VisualOdometry::VisualOdometry(
   // **** inititialize state variables
   
   f2b_.setIdentity();
+  f2b_model_.setIdentity();
+  has_last_keyframe_ = false;
+
+  createMotionPrior();
 
   // **** publishers
 
@@ -51,16 +58,69 @@ VisualOdometry::VisualOdometry(
     "pose", queue_size_);
   path_pub_ = nh_.advertise<PathMsg>(
     "path", queue_size_);
+
+  if (publish_keyframe_bundles_)
+  {
+    keyframe_bundle_publisher_.advertise<KeyframeBundle>(
+      nh_, "keyframe_bundles", queue_size_);
+  }
+
+  if (publish_path_ && path_period_ > 0.0)
+  {
+    path_timer_ = nh_.createTimer(
+      ros::Duration(path_period_), 
+      &VisualOdometry::pathTimerCallback, this);
+  }
     
-  feature_cloud_publisher_ = nh_.advertise<PointCloudFeature>(
-    "feature/cloud", 1);
-  feature_cov_publisher_ = nh_.advertise<visualization_msgs::Marker>(
-    "feature/covariances", 1);
+  // the clouds are only built when the topics have subscribers
+  feature_cloud_publisher_.advertise<PointCloudFeature>(
+    nh_, "feature/cloud", 1, feature_cloud_rate_);
+  feature_cov_publisher_.advertise<visualization_msgs::Marker>(
+    nh_, "feature/covariances", 1, feature_cloud_rate_);
     
-  model_cloud_publisher_ = nh_.advertise<PointCloudFeature>(
-    "model/cloud", 1);
-  model_cov_publisher_ = nh_.advertise<visualization_msgs::Marker>(
-    "model/covariances", 1);
+  model_cloud_publisher_.advertise<PointCloudFeature>(
+    nh_, "model/cloud", 1, model_cloud_rate_);
+  model_cov_publisher_.advertise<visualization_msgs::Marker>(
+    nh_, "model/covariances", 1, model_cloud_rate_);
+
+  // **** latency statistics
+
+  hist_frame_    = LatencyHistogram(diagnostics_window_);
+  hist_features_ = LatencyHistogram(diagnostics_window_);
+  hist_reg_      = LatencyHistogram(diagnostics_window_);
+  hist_publish_  = LatencyHistogram(diagnostics_window_);
+  hist_total_    = LatencyHistogram(diagnostics_window_);
+
+  if (publish_diagnostics_)
+  {
+    diagnostics_publisher_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>(
+      "diagnostics", 1);
+    diagnostics_timer_ = nh_.createTimer(
+      ros::Duration(diagnostics_period_), 
+      &VisualOdometry::diagnosticsTimerCallback, this);
+  }
+
+  // **** pipeline workers
+
+  if (pipeline_ || latest_frame_only_)
+  {
+    if (pipeline_) ROS_INFO("Pipelined processing enabled");
+    if (latest_frame_only_) ROS_INFO("Latest-frame-only scheduling enabled");
+
+    // in latest-frame-only mode, the queue holds only the newest frame
+    int input_queue_size = latest_frame_only_ ? 1 : pipeline_queue_size_;
+
+    input_queue_.reset(new PipelineQueue(input_queue_size));
+    detection_thread_ = boost::thread(
+      boost::bind(&VisualOdometry::detectionThread, this));
+  }
+
+  if (pipeline_)
+  {
+    feature_queue_.reset(new PipelineQueue(pipeline_queue_size_));
+    registration_thread_ = boost::thread(
+      boost::bind(&VisualOdometry::registrationThread, this));
+  }
   
   // **** subscribers
   
@@ -80,7 +140,17 @@ VisualOdometry::VisualOdometry(
 
 VisualOdometry::~VisualOdometry()
 {
-  fclose(diagnostics_file_);
+  if (input_queue_)
+  {
+    input_queue_->shutdown();
+    detection_thread_.join();
+  }
+  if (feature_queue_)
+  {
+    feature_queue_->shutdown();
+    registration_thread_.join();
+  }
+
   ROS_INFO("Destroying RGBD Visual Odometry"); 
 }
 
@@ -90,16 +160,44 @@ void VisualOdometry::initParams()
     publish_tf_ = true;  
   if (!nh_private_.getParam ("publish_path", publish_path_))
     publish_path_ = true;
+  if (!nh_private_.getParam ("path/max_poses", path_max_poses_))
+    path_max_poses_ = 0;
+  if (!nh_private_.getParam ("path/min_dist", path_min_dist_))
+    path_min_dist_ = 0.0;
+  if (!nh_private_.getParam ("path/min_angle", path_min_angle_))
+    path_min_angle_ = 0.0;
+  if (!nh_private_.getParam ("path/period", path_period_))
+    path_period_ = 0.0;
   if (!nh_private_.getParam ("publish_odom", publish_odom_))
     publish_odom_ = true;
   if (!nh_private_.getParam ("publish_pose", publish_pose_))
     publish_pose_ = true;
+  if (!nh_private_.getParam ("keyframe/publish_bundles", publish_keyframe_bundles_))
+    publish_keyframe_bundles_ = false;
+  if (!nh_private_.getParam ("keyframe/dist_eps", kf_dist_eps_))
+    kf_dist_eps_ = 0.25;
+  if (!nh_private_.getParam ("keyframe/angle_eps", kf_angle_eps_))
+    kf_angle_eps_ = 0.35;
   if (!nh_private_.getParam ("fixed_frame", fixed_frame_))
     fixed_frame_ = "/odom";
   if (!nh_private_.getParam ("base_frame", base_frame_))
     base_frame_ = "/camera_link";
   if (!nh_private_.getParam ("queue_size", queue_size_))
     queue_size_ = 5;
+  if (!nh_private_.getParam ("pipeline", pipeline_))
+    pipeline_ = false;
+  if (!nh_private_.getParam ("pipeline_queue_size", pipeline_queue_size_))
+    pipeline_queue_size_ = 2;
+  if (!nh_private_.getParam ("latest_frame_only", latest_frame_only_))
+    latest_frame_only_ = false;
+  if (!nh_private_.getParam ("max_latency", max_latency_))
+    max_latency_ = 0.0;
+  if (!nh_private_.getParam ("reg/motion_prior", motion_prior_type_))
+    motion_prior_type_ = "none";
+  if (!nh_private_.getParam ("reg/motion_prior_topic", motion_prior_topic_))
+    motion_prior_topic_ = "prior_odom";
+  if (!nh_private_.getParam ("reg/motion_prior_buffer", motion_prior_buffer_))
+    motion_prior_buffer_ = 2.0;
 
   // detector params
   
@@ -107,29 +205,44 @@ void VisualOdometry::initParams()
     publish_feature_cloud_ = false;
   if (!nh_private_.getParam ("feature/publish_feature_covariances", publish_feature_cov_))
     publish_feature_cov_ = false;
+  if (!nh_private_.getParam ("feature/cloud_rate", feature_cloud_rate_))
+    feature_cloud_rate_ = 0.0;
   if (!nh_private_.getParam ("feature/detector_type", detector_type_))
     detector_type_ = "GFT";
+  if (!nh_private_.getParam ("feature/tiles/rows", tile_rows_))
+    tile_rows_ = 1;
+  if (!nh_private_.getParam ("feature/tiles/cols", tile_cols_))
+    tile_cols_ = 1;
+  if (!nh_private_.getParam ("feature/tiles/overlap", tile_overlap_))
+    tile_overlap_ = 16;
+  if (!nh_private_.getParam ("feature/tiles/threads", tile_threads_))
+    tile_threads_ = -1;
+
+  if (tile_rows_ * tile_cols_ > 1)
+  {
+    thread_pool_.reset(new ThreadPool(tile_threads_));
+    tiled_detector_.reset(new TiledFeatureDetector(
+      tile_rows_, tile_cols_, tile_overlap_, thread_pool_));
+    ROS_INFO("Tiled feature detection: %dx%d tiles, %d worker threads", 
+      tile_rows_, tile_cols_, thread_pool_->getNumThreads());
+  }
   
   resetDetector();
   
-  int smooth;
-  double max_range, max_stdev;
+  configureFeatureDetector(nh_private_, *feature_detector_);
   
-  if (!nh_private_.getParam ("feature/smooth", smooth))
-    smooth = 0;
-  if (!nh_private_.getParam ("feature/max_range", max_range))
-    max_range = 5.5;
-  if (!nh_private_.getParam ("feature/max_stdev", max_stdev))
-    max_stdev = 0.03;
-  
-  feature_detector_->setSmooth(smooth);
-  feature_detector_->setMaxRange(max_range);
-  feature_detector_->setMaxStDev(max_stdev);
+  if (tiled_detector_)
+  {
+    for (int idx = 0; idx < tiled_detector_->getNumTiles(); ++idx)
+      configureFeatureDetector(nh_private_, *tiled_detector_->getDetectors()[idx]);
+  }
   
   // registration params
   
   configureMotionEstimation();
 
+  configureFeatureController();
+
   // diagnostic params
 
   if (!nh_private_.getParam("verbose", verbose_))
@@ -138,76 +251,108 @@ void VisualOdometry::initParams()
     save_diagnostics_ = false;
   if (!nh_private_.getParam("diagnostics_file_name", diagnostics_file_name_))
     diagnostics_file_name_ = "diagnostics.csv";
+  if (!nh_private_.getParam("publish_diagnostics", publish_diagnostics_))
+    publish_diagnostics_ = true;
+  if (!nh_private_.getParam("diagnostics_period", diagnostics_period_))
+    diagnostics_period_ = 1.0;
+  if (!nh_private_.getParam("diagnostics_window", diagnostics_window_))
+    diagnostics_window_ = 1000;
   
   if(save_diagnostics_)
   {
-    diagnostics_file_ = fopen(diagnostics_file_name_.c_str(), "w");
+    diagnostics_writer_.reset(new AsyncFileWriter(diagnostics_file_name_));
 
-    if (diagnostics_file_ == NULL)
+    if (!diagnostics_writer_->isOpen())
     {
       ROS_ERROR("Can't create diagnostic file %s\n", diagnostics_file_name_.c_str());
+      diagnostics_writer_.reset();
       return;
     }
 
     // print header
-    fprintf(diagnostics_file_, "%s, %s, %s, %s, %s, %s, %s, %s\n",
-      "Frame id",
-      "Frame dur.",
-      "All features", "Valid features",
-      "Feat extr. dur.",
-      "Model points", "Registration dur.",
-      "Total dur.");
+    diagnostics_writer_->write(
+      "Frame id, Frame dur., All features, Valid features, Feat extr. dur., "
+      "Model points, Registration dur., Publish dur., Total dur., Dropped frames");
   }
 }
 
 void VisualOdometry::configureMotionEstimation()
 {
-  int motion_constraint;
-
-  if (!nh_private_.getParam ("reg/motion_constraint", motion_constraint))
-    motion_constraint = 0;
-
-  motion_estimation_.setMotionConstraint(motion_constraint);
-
-  double tf_epsilon_linear;
-  double tf_epsilon_angular;
-  int max_iterations;
-  int min_correspondences;
-  int max_model_size;
-  double max_corresp_dist_eucl;
-  double max_assoc_dist_mah;
-  int n_nearest_neighbors;   
-
-  if (!nh_private_.getParam ("reg/ICPProbModel/tf_epsilon_linear", tf_epsilon_linear))
-    tf_epsilon_linear = 1e-4; // 1 mm
-  if (!nh_private_.getParam ("reg/ICPProbModel/tf_epsilon_angular", tf_epsilon_angular))
-    tf_epsilon_angular = 1.7e-3; // 1 deg
-  if (!nh_private_.getParam ("reg/ICPProbModel/max_iterations", max_iterations))
-    max_iterations = 10;
-  if (!nh_private_.getParam ("reg/ICPProbModel/min_correspondences", min_correspondences))
-    min_correspondences = 15;
-  if (!nh_private_.getParam ("reg/ICPProbModel/max_model_size", max_model_size))
-    max_model_size = 3000;
-  if (!nh_private_.getParam ("reg/ICPProbModel/max_corresp_dist_eucl", max_corresp_dist_eucl))
-    max_corresp_dist_eucl = 0.15;
-  if (!nh_private_.getParam ("reg/ICPProbModel/max_assoc_dist_mah", max_assoc_dist_mah))
-    max_assoc_dist_mah = 10.0;
-  if (!nh_private_.getParam ("reg/ICPProbModel/n_nearest_neighbors", n_nearest_neighbors))
-    n_nearest_neighbors = 4;      
-    
   if (!nh_private_.getParam ("reg/ICPProbModel/publish_model_cloud", publish_model_cloud_))
     publish_model_cloud_ = false;
   if (!nh_private_.getParam ("reg/ICPProbModel/publish_model_covariances", publish_model_cov_))
     publish_model_cov_ = false; 
+  if (!nh_private_.getParam ("reg/ICPProbModel/model_cloud_rate", model_cloud_rate_))
+    model_cloud_rate_ = 0.0;
+
+  if (!nh_private_.getParam ("reg/ICPProbModel/model_index", model_index_type_))
+    model_index_type_ = "kdtree";
+
+  if (model_index_type_ == "voxel_hash")
+  {
+    ROS_INFO("Using voxel hash model index");
+    icp_voxel_.reset(new MotionEstimationICPProbModelVoxel());
+    ccny_rgbd::configureMotionEstimation(nh_private_, *icp_voxel_);
+    motion_estimation_ = icp_voxel_;
+  }
+  else
+  {
+    if (model_index_type_ != "kdtree")
+      ROS_WARN("%s is not a valid model index type! Using kdtree", 
+        model_index_type_.c_str());
     
-  motion_estimation_.setTfEpsilonLinear(tf_epsilon_linear);
-  motion_estimation_.setTfEpsilonAngular(tf_epsilon_angular);
-  motion_estimation_.setMaxIterations(max_iterations);
-  motion_estimation_.setMinCorrespondences(min_correspondences);
-  motion_estimation_.setMaxModelSize(max_model_size);
-  motion_estimation_.setMaxCorrespondenceDistEuclidean(max_corresp_dist_eucl);
-  motion_estimation_.setMaxAssociationDistMahalanobis(max_assoc_dist_mah);
-  motion_estimation_.setNNearestNeighbors(n_nearest_neighbors);
+    icp_kdtree_.reset(new rgbdtools::MotionEstimationICPProbModel());
+    ccny_rgbd::configureMotionEstimation(nh_private_, *icp_kdtree_);
+    motion_estimation_ = icp_kdtree_;
+  }
+}
+
+void VisualOdometry::createMotionPrior()
+{
+  if (motion_prior_type_ == "constant_velocity")
+  {
+    ROS_INFO("Using constant velocity motion prior");
+    motion_prior_.reset(new ConstantVelocityMotionPrior());
+  }
+  else if (motion_prior_type_ == "odometry")
+  {
+    ROS_INFO("Using odometry motion prior from %s", motion_prior_topic_.c_str());
+    motion_prior_.reset(new OdometryMotionPrior(
+      nh_, motion_prior_topic_, motion_prior_buffer_));
+  }
+  else if (motion_prior_type_ != "none")
+  {
+    ROS_WARN("%s is not a valid motion prior type! Using none", 
+      motion_prior_type_.c_str());
+  }
+}
+
+void VisualOdometry::seedRegistration(
+  rgbdtools::RGBDFrame& frame, 
+  const tf::Transform& f2b_pred)
+{
+  // camera frame -> predicted fixed frame -> camera frame, 
+  // as seen from the internal estimate
+  AffineTransform seed = eigenAffineFromTf(
+    (f2b_model_ * b2c_).inverse() * f2b_pred * b2c_);
+  
+  kp_means_backup_ = frame.kp_means;
+  kp_covariances_backup_ = frame.kp_covariances;
+
+  const Eigen::Matrix3f R = seed.rotation();
+
+  for (unsigned int idx = 0; idx < frame.kp_means.size(); ++idx)
+  {
+    if (!frame.kp_valid[idx]) continue;
+    frame.kp_means[idx] = seed * frame.kp_means[idx];
+    frame.kp_covariances[idx] = R * frame.kp_covariances[idx] * R.transpose();
+  }
+}
+
+void VisualOdometry::unseedRegistration(rgbdtools::RGBDFrame& frame)
+{
+  frame.kp_means.swap(kp_means_backup_);
+  frame.kp_covariances.swap(kp_covariances_backup_);
 }
 
 void VisualOdometry::resetDetector()
@@ -221,6 +366,7 @@ void VisualOdometry::resetDetector()
   { 
     ROS_INFO("Creating ORB detector");
     feature_detector_.reset(new rgbdtools::OrbDetector());
+    createTileDetectors<rgbdtools::OrbDetector>();
     orb_config_server_.reset(new 
       OrbDetectorConfigServer(ros::NodeHandle(nh_private_, "feature/ORB")));
     
@@ -233,6 +379,7 @@ void VisualOdometry::resetDetector()
   {
     ROS_WARN("SURF detector not supported. Using ORB instead");
     feature_detector_.reset(new rgbdtools::OrbDetector());
+    createTileDetectors<rgbdtools::OrbDetector>();
     orb_config_server_.reset(new
       OrbDetectorConfigServer(ros::NodeHandle(nh_private_, "feature/ORB")));
 
@@ -245,6 +392,7 @@ void VisualOdometry::resetDetector()
   {
     ROS_INFO("Creating GFT detector");
     feature_detector_.reset(new rgbdtools::GftDetector());
+    createTileDetectors<rgbdtools::GftDetector>();
     gft_config_server_.reset(new 
       GftDetectorConfigServer(ros::NodeHandle(nh_private_, "feature/GFT")));
     
@@ -257,6 +405,7 @@ void VisualOdometry::resetDetector()
   {
     ROS_INFO("Creating STAR detector");
     feature_detector_.reset(new rgbdtools::StarDetector());
+    createTileDetectors<rgbdtools::StarDetector>();
     star_config_server_.reset(new 
       StarDetectorConfigServer(ros::NodeHandle(nh_private_, "feature/STAR")));
     
@@ -269,6 +418,7 @@ void VisualOdometry::resetDetector()
   {
     ROS_FATAL("%s is not a valid detector type! Using GFT", detector_type_.c_str());
     feature_detector_.reset(new rgbdtools::GftDetector());
+    createTileDetectors<rgbdtools::GftDetector>();
     gft_config_server_.reset(new 
       GftDetectorConfigServer(ros::NodeHandle(nh_private_, "feature/GFT")));
     
@@ -284,7 +434,8 @@ void VisualOdometry::RGBDCallback(
   const ImageMsg::ConstPtr& depth_msg,
   const CameraInfoMsg::ConstPtr& info_msg)
 {
-  ros::WallTime start = ros::WallTime::now();
+  PipelineFrame pf;
+  pf.start = ros::WallTime::now();
 
   // **** initialize ***************************************************
 
@@ -294,42 +445,164 @@ void VisualOdometry::RGBDCallback(
     init_time_ = rgb_msg->header.stamp;
     if (!initialized_) return;
 
-    motion_estimation_.setBaseToCameraTf(eigenAffineFromTf(b2c_));
+    motion_estimation_->setBaseToCameraTf(eigenAffineFromTf(b2c_));
+  }
+
+  pf.rgb_msg   = rgb_msg;
+  pf.depth_msg = depth_msg;
+  pf.info_msg  = info_msg;
+
+  // **** process ******************************************************
+
+  if (input_queue_)
+  {
+    // blocks while the detection stage is behind, 
+    // or replaces the older frame in latest-frame-only mode
+    schedule(*input_queue_, pf);
   }
+  else
+  {
+    if (isStale(pf)) return;
+    createFrameAndFeatures(pf);
+    registerAndPublish(pf);
+  }
+}
+
+void VisualOdometry::detectionThread()
+{
+  PipelineFrame pf;
+
+  while(input_queue_->pop(pf))
+  {
+    if (isStale(pf)) continue;
+
+    createFrameAndFeatures(pf);
+
+    if (!pipeline_) 
+      registerAndPublish(pf);
+    else if (!schedule(*feature_queue_, pf)) 
+      break;
+  }
+}
+
+void VisualOdometry::registrationThread()
+{
+  PipelineFrame pf;
 
+  while(feature_queue_->pop(pf))
+  {
+    if (isStale(pf)) continue;
+
+    registerAndPublish(pf);
+  }
+}
+
+bool VisualOdometry::schedule(PipelineQueue& queue, const PipelineFrame& pf)
+{
+  if (latest_frame_only_)
+  {
+    countDroppedFrames(queue.pushDropOldest(pf));
+    return true;
+  }
+  else
+    return queue.push(pf);
+}
+
+bool VisualOdometry::isStale(const PipelineFrame& pf)
+{
+  if (max_latency_ <= 0.0) return false;
+
+  double latency = (ros::Time::now() - pf.rgb_msg->header.stamp).toSec();
+  if (latency <= max_latency_) return false;
+
+  countDroppedFrames(1);
+  return true;
+}
+
+void VisualOdometry::countDroppedFrames(int n)
+{
+  boost::mutex::scoped_lock lock(drop_mutex_);
+  n_dropped_frames_ += n;
+}
+
+void VisualOdometry::createFrameAndFeatures(PipelineFrame& pf)
+{
   // **** create frame *************************************************
 
   ros::WallTime start_frame = ros::WallTime::now();
-  rgbdtools::RGBDFrame frame;
-  createRGBDFrameFromROSMessages(rgb_msg, depth_msg, info_msg, frame); 
+  pf.frame = frame_builder_.acquire();
+  frame_builder_.build(pf.rgb_msg, pf.depth_msg, pf.info_msg, *pf.frame); 
   ros::WallTime end_frame = ros::WallTime::now();
 
   // **** find features ************************************************
 
   ros::WallTime start_features = ros::WallTime::now();
-  feature_detector_->findFeatures(frame);
+  {
+    boost::mutex::scoped_lock lock(detector_mutex_);
+    if (tiled_detector_)
+      tiled_detector_->findFeatures(*pf.frame);
+    else
+      feature_detector_->findFeatures(*pf.frame);
+  }
   ros::WallTime end_features = ros::WallTime::now();
 
+  pf.d_frame    = 1000.0 * (end_frame    - start_frame   ).toSec();
+  pf.d_features = 1000.0 * (end_features - start_features).toSec();
+}
+
+void VisualOdometry::registerAndPublish(PipelineFrame& pf)
+{
+  rgbdtools::RGBDFrame& frame = *pf.frame;
+  const std_msgs::Header& header = pf.rgb_msg->header;
+
   // **** registration *************************************************
   
   ros::WallTime start_reg = ros::WallTime::now();
-  AffineTransform m = motion_estimation_.getMotionEstimation(frame);
+
+  // without a prediction, seeding with f2b_ still keeps the 
+  // internal estimate in line with the published one
+  tf::Transform f2b_pred = f2b_;
+  if (motion_prior_) 
+  {
+    motion_prior_->getPrediction(header.stamp, f2b_, f2b_pred);
+    seedRegistration(frame, f2b_pred);
+  }
+  
+  AffineTransform m = motion_estimation_->getMotionEstimation(frame);
+  
+  if (motion_prior_) unseedRegistration(frame);
+
+  // the correction applies on top of the prediction
   tf::Transform motion = tfFromEigenAffine(m);
-  f2b_ = motion * f2b_;
+  f2b_model_ = motion * f2b_model_;
+  f2b_ = motion * f2b_pred;
+
+  if (motion_prior_) motion_prior_->update(header.stamp, f2b_);
+
   ros::WallTime end_reg = ros::WallTime::now();
 
   // **** publish outputs **********************************************
   
-  if (publish_tf_)    publishTf(rgb_msg->header);
-  if (publish_odom_)  publishOdom(rgb_msg->header);
-  if (publish_path_)  publishPath(rgb_msg->header);
-  if (publish_pose_)  publishPoseStamped(rgb_msg->header);
+  ros::WallTime start_publish = ros::WallTime::now();
+
+  if (publish_tf_)    publishTf(header);
+  if (publish_odom_)  publishOdom(header);
+  if (publish_path_)  publishPath(header);
+  if (publish_pose_)  publishPoseStamped(header);
   
-  if (publish_feature_cloud_) publishFeatureCloud(frame);
-  if (publish_feature_cov_) publishFeatureCovariances(frame);
+  if (publish_keyframe_bundles_) publishKeyframeBundle(pf);
+
+  if (publish_feature_cloud_ && feature_cloud_publisher_.shouldPublish()) 
+    publishFeatureCloud(frame);
+  if (publish_feature_cov_ && feature_cov_publisher_.shouldPublish()) 
+    publishFeatureCovariances(frame);
   
-  if (publish_model_cloud_) publishModelCloud();
-  if (publish_model_cov_)   publishModelCovariances();
+  if (publish_model_cloud_ && model_cloud_publisher_.shouldPublish()) 
+    publishModelCloud();
+  if (publish_model_cov_ && model_cov_publisher_.shouldPublish())
+    publishModelCovariances();
+
+  ros::WallTime end_publish = ros::WallTime::now();
 
   // **** print diagnostics *******************************************
 
@@ -339,15 +612,28 @@ void VisualOdometry::RGBDCallback(
   
   int n_features = frame.keypoints.size();
   int n_valid_features = frame.n_valid_keypoints;
-  int n_model_pts = motion_estimation_.getModelSize();
+  int n_model_pts = icp_voxel_ ? 
+    icp_voxel_->getModelSize() : icp_kdtree_->getModelSize();
+
+  drop_mutex_.lock();
+  int n_dropped = n_dropped_frames_;
+  drop_mutex_.unlock();
 
-  double d_frame    = 1000.0 * (end_frame    - start_frame   ).toSec();
-  double d_features = 1000.0 * (end_features - start_features).toSec();
   double d_reg      = 1000.0 * (end_reg      - start_reg     ).toSec();
-  double d_total    = 1000.0 * (end          - start         ).toSec();
+  double d_publish  = 1000.0 * (end_publish  - start_publish ).toSec();
+  double d_total    = 1000.0 * (end          - pf.start      ).toSec();
+
+  // **** adapt the detector to the time budget ***********************
+
+  {
+    boost::mutex::scoped_lock lock(detector_mutex_);
+    if (feature_controller_.update(
+          pf.d_features, d_reg, n_features, n_valid_features))
+      applyFeatureController();
+  }
 
-  diagnostics(n_features, n_valid_features, n_model_pts,
-              d_frame, d_features, d_reg, d_total);
+  diagnostics(n_features, n_valid_features, n_model_pts, n_dropped,
+              pf.d_frame, pf.d_features, d_reg, d_publish, d_total);
 }
 
 void VisualOdometry::publishTf(const std_msgs::Header& header)
@@ -362,10 +648,38 @@ void VisualOdometry::publishOdom(const std_msgs::Header& header)
   OdomMsg odom;
   odom.header.stamp = header.stamp;
   odom.header.frame_id = fixed_frame_;
+  odom.child_frame_id = base_frame_;
   tf::poseTFToMsg(f2b_, odom.pose.pose);
   odom_publisher_.publish(odom);
 }
 
+void VisualOdometry::publishKeyframeBundle(const PipelineFrame& pf)
+{
+  if (!keyframe_bundle_publisher_.hasSubscribers()) return;
+  
+  tf::Transform f2c = f2b_ * b2c_;
+  
+  // only send the images when the camera moved enough since
+  // the last keyframe candidate
+  if (has_last_keyframe_ && 
+      !tfGreaterThan(last_keyframe_f2c_.inverse() * f2c, 
+                     kf_dist_eps_, kf_angle_eps_))
+    return;
+
+  last_keyframe_f2c_ = f2c;
+  has_last_keyframe_ = true;
+
+  KeyframeBundle::Ptr bundle_msg = boost::make_shared<KeyframeBundle>();
+  bundle_msg->header.stamp    = pf.rgb_msg->header.stamp;
+  bundle_msg->header.frame_id = fixed_frame_;
+  bundle_msg->rgb   = *pf.rgb_msg;
+  bundle_msg->depth = *pf.depth_msg;
+  bundle_msg->info  = *pf.info_msg;
+  tf::poseTFToMsg(f2c, bundle_msg->pose);
+
+  keyframe_bundle_publisher_.publish(bundle_msg);
+}
+
 void VisualOdometry::publishPoseStamped(const std_msgs::Header& header)
 {
   geometry_msgs::PoseStamped::Ptr pose_stamped_msg;
@@ -379,15 +693,67 @@ void VisualOdometry::publishPoseStamped(const std_msgs::Header& header)
 
 void VisualOdometry::publishPath(const std_msgs::Header& header)
 {
-  path_msg_.header.stamp = header.stamp;
+  {
+    boost::mutex::scoped_lock lock(path_mutex_);
+
+    // decimate: skip poses too close to the last one
+    if (!path_poses_.empty() && 
+        !tfGreaterThan(last_path_pose_.inverse() * f2b_, 
+                       path_min_dist_, path_min_angle_))
+      return;
+
+    PathPose pose;
+    pose.stamp = header.stamp;
+    
+    const tf::Vector3& t = f2b_.getOrigin();
+    tf::Quaternion q = f2b_.getRotation();
+    pose.x  = t.x();  pose.y  = t.y();  pose.z  = t.z();
+    pose.qx = q.x();  pose.qy = q.y();  pose.qz = q.z();  pose.qw = q.w();
+    
+    path_poses_.push_back(pose);
+    last_path_pose_ = f2b_;
+
+    if (path_max_poses_ > 0 && (int)path_poses_.size() > path_max_poses_)
+      path_poses_.pop_front();
+  }
+
+  // without a republishing period, publish every frame
+  if (path_period_ <= 0.0) publishPathMsg();
+}
+
+void VisualOdometry::pathTimerCallback(const ros::TimerEvent& event)
+{
+  publishPathMsg();
+}
+
+void VisualOdometry::publishPathMsg()
+{
+  if (path_pub_.getNumSubscribers() == 0) return;
+
+  boost::mutex::scoped_lock lock(path_mutex_);
+
+  if (path_poses_.empty()) return;
+
+  path_msg_.header.stamp = path_poses_.back().stamp;
   path_msg_.header.frame_id = fixed_frame_;
+  path_msg_.poses.resize(path_poses_.size());
+
+  for (unsigned int idx = 0; idx < path_poses_.size(); ++idx)
+  {
+    const PathPose& pose = path_poses_[idx];
+    geometry_msgs::PoseStamped& pose_stamped = path_msg_.poses[idx];
 
-  geometry_msgs::PoseStamped pose_stamped;
-  pose_stamped.header.stamp = header.stamp;
-  pose_stamped.header.frame_id = fixed_frame_;
-  tf::poseTFToMsg(f2b_, pose_stamped.pose);
+    pose_stamped.header.stamp = pose.stamp;
+    pose_stamped.header.frame_id = fixed_frame_;
+    pose_stamped.pose.position.x = pose.x;
+    pose_stamped.pose.position.y = pose.y;
+    pose_stamped.pose.position.z = pose.z;
+    pose_stamped.pose.orientation.x = pose.qx;
+    pose_stamped.pose.orientation.y = pose.qy;
+    pose_stamped.pose.orientation.z = pose.qz;
+    pose_stamped.pose.orientation.w = pose.qw;
+  }
 
-  path_msg_.poses.push_back(pose_stamped);
   path_pub_.publish(path_msg_);
 }
 
@@ -395,12 +761,22 @@ bool VisualOdometry::getBaseToCameraTf(const std_msgs::Header& header)
 {
   tf::StampedTransform tf_m;
 
+  // The base to camera transform is static, so the latest available one
+  // is used. This never blocks: until the transform has been received,
+  // frames are skipped at the cost of a buffer lookup.
+  std::string error_msg;
+  if (!tf_listener_.canTransform(
+        base_frame_, header.frame_id, ros::Time(0), &error_msg))
+  {
+    ROS_WARN_THROTTLE(2.0, "Base to camera transform unavailable, "
+      "skipping frames: %s", error_msg.c_str());
+    return false;
+  }
+
   try
   {
-    tf_listener_.waitForTransform(
-      base_frame_, header.frame_id, header.stamp, ros::Duration(1.0));
     tf_listener_.lookupTransform (
-      base_frame_, header.frame_id, header.stamp, tf_m);
+      base_frame_, header.frame_id, ros::Time(0), tf_m);
   }
   catch (tf::TransformException& ex)
   {
@@ -415,58 +791,267 @@ bool VisualOdometry::getBaseToCameraTf(const std_msgs::Header& header)
 
 void VisualOdometry::gftReconfigCallback(GftDetectorConfig& config, uint32_t level)
 {
+  boost::mutex::scoped_lock lock(detector_mutex_);
+
   rgbdtools::GftDetectorPtr gft_detector = 
     boost::static_pointer_cast<rgbdtools::GftDetector>(feature_detector_);
     
   gft_detector->setNFeatures(config.n_features);
   gft_detector->setMinDistance(config.min_distance); 
+
+  feature_controller_.reset(config.n_features, 0.0);
+
+  if (!tiled_detector_) return;
+  
+  for (int idx = 0; idx < tiled_detector_->getNumTiles(); ++idx)
+  {
+    rgbdtools::GftDetectorPtr tile_detector = 
+      boost::static_pointer_cast<rgbdtools::GftDetector>(
+        tiled_detector_->getDetectors()[idx]);
+
+    tile_detector->setNFeatures(tiled_detector_->getTileQuota(config.n_features, idx));
+    tile_detector->setMinDistance(config.min_distance); 
+  }
 }
 
 void VisualOdometry::starReconfigCallback(StarDetectorConfig& config, uint32_t level)
 {
+  boost::mutex::scoped_lock lock(detector_mutex_);
+
   rgbdtools::StarDetectorPtr star_detector = 
     boost::static_pointer_cast<rgbdtools::StarDetector>(feature_detector_);
     
   star_detector->setThreshold(config.threshold);
   star_detector->setMinDistance(config.min_distance); 
+
+  feature_controller_.reset(0, config.threshold);
+
+  if (!tiled_detector_) return;
+  
+  for (int idx = 0; idx < tiled_detector_->getNumTiles(); ++idx)
+  {
+    rgbdtools::StarDetectorPtr tile_detector = 
+      boost::static_pointer_cast<rgbdtools::StarDetector>(
+        tiled_detector_->getDetectors()[idx]);
+
+    tile_detector->setThreshold(config.threshold);
+    tile_detector->setMinDistance(config.min_distance); 
+  }
 }
 
 void VisualOdometry::orbReconfigCallback(OrbDetectorConfig& config, uint32_t level)
 {
+  boost::mutex::scoped_lock lock(detector_mutex_);
+
   rgbdtools::OrbDetectorPtr orb_detector = 
     boost::static_pointer_cast<rgbdtools::OrbDetector>(feature_detector_);
     
   orb_detector->setThreshold(config.threshold);
   orb_detector->setNFeatures(config.n_features);
+
+  feature_controller_.reset(config.n_features, config.threshold);
+
+  if (!tiled_detector_) return;
+  
+  for (int idx = 0; idx < tiled_detector_->getNumTiles(); ++idx)
+  {
+    rgbdtools::OrbDetectorPtr tile_detector = 
+      boost::static_pointer_cast<rgbdtools::OrbDetector>(
+        tiled_detector_->getDetectors()[idx]);
+
+    tile_detector->setThreshold(config.threshold);
+    tile_detector->setNFeatures(tiled_detector_->getTileQuota(config.n_features, idx));
+  }
+}
+
+void VisualOdometry::configureFeatureController()
+{
+  double budget, min_threshold, max_threshold, smoothing, valid_margin;
+  int min_features, max_features, min_correspondences;
+
+  if (!nh_private_.getParam ("feature/adaptive/budget", budget))
+    budget = 0.0;
+  if (!nh_private_.getParam ("feature/adaptive/min_features", min_features))
+    min_features = 50;
+  if (!nh_private_.getParam ("feature/adaptive/max_features", max_features))
+    max_features = 1000;
+  if (!nh_private_.getParam ("feature/adaptive/min_threshold", min_threshold))
+    min_threshold = 5.0;
+  if (!nh_private_.getParam ("feature/adaptive/max_threshold", max_threshold))
+    max_threshold = 100.0;
+  if (!nh_private_.getParam ("feature/adaptive/smoothing", smoothing))
+    smoothing = 0.2;
+  if (!nh_private_.getParam ("feature/adaptive/valid_margin", valid_margin))
+    valid_margin = 2.0;
+  if (!nh_private_.getParam ("reg/ICPProbModel/min_correspondences", min_correspondences))
+    min_correspondences = 15;
+
+  boost::mutex::scoped_lock lock(detector_mutex_);
+
+  feature_controller_.setBudget(budget);
+  feature_controller_.setFeatureCountRange(min_features, max_features);
+  feature_controller_.setThresholdRange(min_threshold, max_threshold);
+  feature_controller_.setSmoothing(smoothing);
+  feature_controller_.setMinValid((int)(valid_margin * min_correspondences));
+
+  // GFT has a feature count, STAR a threshold, ORB both
+  bool has_count = 
+    boost::dynamic_pointer_cast<rgbdtools::GftDetector>(feature_detector_) ||
+    boost::dynamic_pointer_cast<rgbdtools::OrbDetector>(feature_detector_);
+  bool has_threshold =
+    boost::dynamic_pointer_cast<rgbdtools::StarDetector>(feature_detector_) ||
+    boost::dynamic_pointer_cast<rgbdtools::OrbDetector>(feature_detector_);
+  
+  feature_controller_.setControlled(has_count, has_threshold);
+
+  if (feature_controller_.isEnabled())
+    ROS_INFO("Adapting the feature detector to a %.1f ms budget", budget);
+}
+
+void VisualOdometry::applyFeatureController()
+{
+  int n_features = feature_controller_.getFeatureCount();
+  double threshold = feature_controller_.getThreshold();
+
+  std::vector<rgbdtools::FeatureDetectorPtr> detectors(1, feature_detector_);
+  if (tiled_detector_)
+    detectors = tiled_detector_->getDetectors();
+
+  for (unsigned int idx = 0; idx < detectors.size(); ++idx)
+  {
+    int quota = tiled_detector_ ? 
+      tiled_detector_->getTileQuota(n_features, idx) : n_features;
+
+    rgbdtools::GftDetectorPtr gft_detector = 
+      boost::dynamic_pointer_cast<rgbdtools::GftDetector>(detectors[idx]);
+    rgbdtools::OrbDetectorPtr orb_detector = 
+      boost::dynamic_pointer_cast<rgbdtools::OrbDetector>(detectors[idx]);
+    rgbdtools::StarDetectorPtr star_detector = 
+      boost::dynamic_pointer_cast<rgbdtools::StarDetector>(detectors[idx]);
+
+    if (gft_detector) 
+    {
+      gft_detector->setNFeatures(quota);
+    }
+    else if (orb_detector)
+    {
+      orb_detector->setNFeatures(quota);
+      orb_detector->setThreshold(threshold);
+    }
+    else if (star_detector)
+    {
+      star_detector->setThreshold(threshold);
+    }
+  }
 }
 
 void VisualOdometry::diagnostics(
-  int n_features, int n_valid_features, int n_model_pts,
-  double d_frame, double d_features, double d_reg, double d_total)
+  int n_features, int n_valid_features, int n_model_pts, int n_dropped,
+  double d_frame, double d_features, double d_reg, double d_publish,
+  double d_total)
 {
-  if(save_diagnostics_ && diagnostics_file_ != NULL)
+  stats_mutex_.lock();
+  hist_frame_.add(d_frame);
+  hist_features_.add(d_features);
+  hist_reg_.add(d_reg);
+  hist_publish_.add(d_publish);
+  hist_total_.add(d_total);
+  stats_frame_count_ = frame_count_;
+  stats_n_model_pts_ = n_model_pts;
+  stats_mutex_.unlock();
+
+  if(diagnostics_writer_)
   {
-    // print to file
-    fprintf(diagnostics_file_, "%d, %2.1f, %d, %3.1f, %d, %4.1f, %4.1f\n",
+    // queue for writing to file
+    char line[256];
+    snprintf(line, sizeof(line), 
+      "%d, %2.1f, %d, %d, %3.1f, %d, %4.1f, %4.1f, %4.1f, %d",
       frame_count_,
       d_frame,
-      n_valid_features, d_features,
+      n_features, n_valid_features, d_features,
       n_model_pts, d_reg,
-      d_total);
+      d_publish, d_total, n_dropped);
+    diagnostics_writer_->write(line);
   }
   if (verbose_)
   {
     // print to screen
-    ROS_INFO("[VO %d] %s[%d]: %.1f Reg[%d]: %.1f TOT: %.1f\n",
+    ROS_INFO("[VO %d] %s[%d]: %.1f Reg[%d]: %.1f TOT: %.1f Drop: %d\n",
       frame_count_,
       detector_type_.c_str(), n_valid_features, d_features,
       n_model_pts, d_reg,
-      d_total);
+      d_total, n_dropped);
   }
 
   return;
 }
 
+void VisualOdometry::diagnosticsTimerCallback(const ros::TimerEvent& event)
+{
+  diagnostic_msgs::DiagnosticArray::Ptr array_msg = 
+    boost::make_shared<diagnostic_msgs::DiagnosticArray>();
+  array_msg->header.stamp = ros::Time::now();
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.name = "VisualOdometry: latency (ms)";
+  status.message = "OK";
+
+  drop_mutex_.lock();
+  int n_dropped = n_dropped_frames_;
+  drop_mutex_.unlock();
+
+  boost::mutex::scoped_lock lock(stats_mutex_);
+
+  diagnostic_msgs::KeyValue kv;
+  kv.key = "Frames"; 
+  kv.value = boost::lexical_cast<std::string>(stats_frame_count_);
+  status.values.push_back(kv);
+  kv.key = "Dropped frames"; 
+  kv.value = boost::lexical_cast<std::string>(n_dropped);
+  status.values.push_back(kv);
+  kv.key = "Model points"; 
+  kv.value = boost::lexical_cast<std::string>(stats_n_model_pts_);
+  status.values.push_back(kv);
+
+  addStageDiagnostics("Frame",        hist_frame_,    status);
+  addStageDiagnostics("Features",     hist_features_, status);
+  addStageDiagnostics("Registration", hist_reg_,      status);
+  addStageDiagnostics("Publish",      hist_publish_,  status);
+  addStageDiagnostics("Total",        hist_total_,    status);
+
+  array_msg->status.push_back(status);
+  diagnostics_publisher_.publish(array_msg);
+}
+
+void VisualOdometry::addStageDiagnostics(
+  const std::string& name,
+  const LatencyHistogram& hist,
+  diagnostic_msgs::DiagnosticStatus& status)
+{
+  double p50, p90, p99, max;
+  hist.getPercentiles(p50, p90, p99, max);
+
+  char value[64];
+  diagnostic_msgs::KeyValue kv;
+
+  snprintf(value, sizeof(value), "%.1f", p50);
+  kv.key = name + " p50"; kv.value = value;
+  status.values.push_back(kv);
+  
+  snprintf(value, sizeof(value), "%.1f", p90);
+  kv.key = name + " p90"; kv.value = value;
+  status.values.push_back(kv);
+  
+  snprintf(value, sizeof(value), "%.1f", p99);
+  kv.key = name + " p99"; kv.value = value;
+  status.values.push_back(kv);
+  
+  snprintf(value, sizeof(value), "%.1f", max);
+  kv.key = name + " max"; kv.value = value;
+  status.values.push_back(kv);
+}
+
 void VisualOdometry::publishFeatureCloud(rgbdtools::RGBDFrame& frame)
 {
   PointCloudFeature feature_cloud; 
@@ -481,7 +1066,8 @@ void VisualOdometry::publishFeatureCovariances(rgbdtools::RGBDFrame& frame)
 
 void VisualOdometry::publishModelCloud()
 {
-  PointCloudFeature::Ptr model_cloud_ptr = motion_estimation_.getModel();
+  PointCloudFeature::Ptr model_cloud_ptr = icp_voxel_ ? 
+    icp_voxel_->getModel() : icp_kdtree_->getModel();
   model_cloud_ptr->header.frame_id = fixed_frame_;
   model_cloud_publisher_.publish(model_cloud_ptr);
 }
@@ -0,0 +1,543 @@
+/**
+ *  @file vo_benchmark.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/apps/vo_benchmark.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <Eigen/Geometry>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "ccny_rgbd/GftDetectorConfig.h"
+#include "ccny_rgbd/StarDetectorConfig.h"
+#include "ccny_rgbd/OrbDetectorConfig.h"
+
+namespace ccny_rgbd {
+
+// number of samples kept by the timing histograms - large enough
+// to hold the timings of a whole sequence
+static const int kHistogramWindow = 100000;
+
+ArgParams::ArgParams(int argc, char** argv)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg(argv[i]);
+    size_t pos = arg.find(":=");
+    if (pos == std::string::npos || pos == 0) continue;
+    
+    std::string name = arg.substr(0, pos);
+    if (name[0] == '_') name = name.substr(1);
+    params_[name] = arg.substr(pos + 2);
+  }
+}
+
+bool ArgParams::getParam(const std::string& name, std::string& value) const
+{
+  std::map<std::string, std::string>::const_iterator it = params_.find(name);
+  if (it == params_.end()) return false;
+  value = it->second;
+  return true;
+}
+
+bool ArgParams::getParam(const std::string& name, double& value) const
+{
+  return getNumeric(name, value);
+}
+
+bool ArgParams::getParam(const std::string& name, int& value) const
+{
+  return getNumeric(name, value);
+}
+
+bool ArgParams::getParam(const std::string& name, bool& value) const
+{
+  std::string str;
+  if (!getParam(name, str)) return false;
+  
+  if (str == "true" || str == "1") value = true;
+  else if (str == "false" || str == "0") value = false;
+  else 
+  {
+    ROS_WARN("Invalid value for parameter %s: %s", name.c_str(), str.c_str());
+    return false;
+  }
+  return true;
+}
+
+VOBenchmark::VOBenchmark(const ArgParams& params):
+  hist_load_(kHistogramWindow),
+  hist_features_(kHistogramWindow),
+  hist_reg_(kHistogramWindow),
+  hist_total_(kHistogramWindow)
+{
+  if (!params.getParam("dataset", dataset_path_))
+    dataset_path_ = ".";
+  if (!params.getParam("output_file", output_file_))
+    output_file_ = "path.tum.txt";
+  if (!params.getParam("max_time_diff", max_time_diff_))
+    max_time_diff_ = 0.02;
+  if (!params.getParam("depth_factor", depth_factor_))
+    depth_factor_ = 5000.0;
+  if (!params.getParam("max_frames", max_frames_))
+    max_frames_ = 0;
+
+  // default intrinsics of the TUM ROS-format datasets
+  if (!params.getParam("fx", fx_)) fx_ = 525.0;
+  if (!params.getParam("fy", fy_)) fy_ = 525.0;
+  if (!params.getParam("cx", cx_)) cx_ = 319.5;
+  if (!params.getParam("cy", cy_)) cy_ = 239.5;
+
+  // same feature and registration configuration as VisualOdometry
+  createFeatureDetector(params);
+  configureFeatureDetector(params, *feature_detector_);
+  createMotionEstimation(params);
+
+  // the dataset poses are camera poses
+  AffineTransform b2c;
+  b2c.setIdentity();
+  motion_estimation_->setBaseToCameraTf(b2c);
+}
+
+VOBenchmark::~VOBenchmark()
+{
+  ROS_INFO("Destroying VO Benchmark"); 
+}
+
+void VOBenchmark::createFeatureDetector(const ArgParams& params)
+{
+  if (!params.getParam("feature/detector_type", detector_type_))
+    detector_type_ = "GFT";
+
+  // detector-specific defaults are the dynamic reconfigure defaults
+  if (detector_type_ == "ORB" || detector_type_ == "SURF")
+  {
+    if (detector_type_ == "SURF")
+      ROS_WARN("SURF detector not supported. Using ORB instead");
+
+    OrbDetectorConfig config = OrbDetectorConfig::__getDefault__();
+    params.getParam("feature/ORB/n_features", config.n_features);
+    params.getParam("feature/ORB/threshold", config.threshold);
+
+    rgbdtools::OrbDetectorPtr orb_detector(new rgbdtools::OrbDetector());
+    orb_detector->setNFeatures(config.n_features);
+    orb_detector->setThreshold(config.threshold);
+    feature_detector_ = orb_detector;
+  }
+  else if (detector_type_ == "STAR")
+  {
+    StarDetectorConfig config = StarDetectorConfig::__getDefault__();
+    params.getParam("feature/STAR/threshold", config.threshold);
+    params.getParam("feature/STAR/min_distance", config.min_distance);
+
+    rgbdtools::StarDetectorPtr star_detector(new rgbdtools::StarDetector());
+    star_detector->setThreshold(config.threshold);
+    star_detector->setMinDistance(config.min_distance);
+    feature_detector_ = star_detector;
+  }
+  else
+  {
+    if (detector_type_ != "GFT")
+      ROS_FATAL("%s is not a valid detector type! Using GFT", detector_type_.c_str());
+    
+    GftDetectorConfig config = GftDetectorConfig::__getDefault__();
+    params.getParam("feature/GFT/n_features", config.n_features);
+    params.getParam("feature/GFT/min_distance", config.min_distance);
+
+    rgbdtools::GftDetectorPtr gft_detector(new rgbdtools::GftDetector());
+    gft_detector->setNFeatures(config.n_features);
+    gft_detector->setMinDistance(config.min_distance);
+    feature_detector_ = gft_detector;
+  }
+}
+
+void VOBenchmark::createMotionEstimation(const ArgParams& params)
+{
+  if (!params.getParam("reg/ICPProbModel/model_index", model_index_type_))
+    model_index_type_ = "kdtree";
+
+  if (model_index_type_ == "voxel_hash")
+  {
+    boost::shared_ptr<MotionEstimationICPProbModelVoxel> icp_voxel(
+      new MotionEstimationICPProbModelVoxel());
+    configureMotionEstimation(params, *icp_voxel);
+    motion_estimation_ = icp_voxel;
+  }
+  else
+  {
+    if (model_index_type_ != "kdtree")
+      ROS_WARN("%s is not a valid model index type! Using kdtree", 
+        model_index_type_.c_str());
+    
+    boost::shared_ptr<rgbdtools::MotionEstimationICPProbModel> icp_kdtree(
+      new rgbdtools::MotionEstimationICPProbModel());
+    configureMotionEstimation(params, *icp_kdtree);
+    motion_estimation_ = icp_kdtree;
+  }
+}
+
+bool VOBenchmark::run()
+{
+  // **** read the dataset lists
+  
+  std::vector<std::pair<double, std::string> > rgb_list, depth_list;
+  
+  if (!readFileList(dataset_path_ + "/rgb.txt", rgb_list) ||
+      !readFileList(dataset_path_ + "/depth.txt", depth_list))
+  {
+    ROS_ERROR("Could not read the image lists from %s", dataset_path_.c_str());
+    return false;
+  }
+  
+  std::vector<ImagePair> pairs;
+  associate(rgb_list, depth_list, pairs);
+  
+  StampedPoseVector groundtruth;
+  if (!readTrajectory(dataset_path_ + "/groundtruth.txt", groundtruth))
+    ROS_WARN("No ground truth found, skipping ATE and RPE");
+
+  int n_frames = pairs.size();
+  if (max_frames_ > 0 && max_frames_ < n_frames) n_frames = max_frames_;
+
+  ROS_INFO("Processing %d frames from %s", n_frames, dataset_path_.c_str());
+
+  // **** process the frames
+  
+  StampedPoseVector estimate;
+  estimate.reserve(n_frames);
+
+  AffineTransform f2b;
+  f2b.setIdentity();
+
+  ros::WallTime start_run = ros::WallTime::now();
+
+  for (int idx = 0; idx < n_frames; ++idx)
+  {
+    ros::WallTime start = ros::WallTime::now();
+    
+    rgbdtools::RGBDFrame frame;
+    if (!createFrame(pairs[idx], idx, frame))
+    {
+      ROS_WARN("Could not load frame %d, skipping", idx);
+      continue;
+    }
+    ros::WallTime end_load = ros::WallTime::now();
+
+    feature_detector_->findFeatures(frame);
+    ros::WallTime end_features = ros::WallTime::now();
+    
+    AffineTransform motion = motion_estimation_->getMotionEstimation(frame);
+    f2b = motion * f2b;
+    ros::WallTime end_reg = ros::WallTime::now();
+
+    hist_load_.add    (1000.0 * (end_load     - start       ).toSec());
+    hist_features_.add(1000.0 * (end_features - end_load    ).toSec());
+    hist_reg_.add     (1000.0 * (end_reg      - end_features).toSec());
+    hist_total_.add   (1000.0 * (end_reg      - start       ).toSec());
+
+    StampedPose stamped_pose;
+    stamped_pose.stamp = pairs[idx].stamp;
+    stamped_pose.pose = f2b;
+    estimate.push_back(stamped_pose);
+  }
+
+  double d_run = (ros::WallTime::now() - start_run).toSec();
+
+  // **** report
+
+  printf("Frames: %d in %.2f s (%.1f frames/s)\n", 
+    (int)estimate.size(), d_run, d_run > 0.0 ? estimate.size() / d_run : 0.0);
+
+  printf("Stage timing [ms]:   p50      p90      p99      max\n");
+  printStage("Load",         hist_load_);
+  printStage("Features",     hist_features_);
+  printStage("Registration", hist_reg_);
+  printStage("Total",        hist_total_);
+
+  if (!groundtruth.empty())
+  {
+    double ate_rmse, rpe_trans_rmse, rpe_rot_rmse;
+    
+    int n_ate = computeATE(estimate, groundtruth, ate_rmse);
+    int n_rpe = computeRPE(estimate, groundtruth, rpe_trans_rmse, rpe_rot_rmse);
+
+    if (n_ate > 0)
+      printf("ATE RMSE: %.4f m (%d poses)\n", ate_rmse, n_ate);
+    if (n_rpe > 0)
+      printf("RPE RMSE: %.4f m, %.3f deg (%d pairs)\n", 
+        rpe_trans_rmse, rpe_rot_rmse, n_rpe);
+  }
+
+  if (saveTrajectory(output_file_, estimate))
+    ROS_INFO("Trajectory saved to %s", output_file_.c_str());
+  else
+    ROS_ERROR("Could not save trajectory to %s", output_file_.c_str());
+
+  return true;
+}
+
+bool VOBenchmark::readFileList(
+  const std::string& filename,
+  std::vector<std::pair<double, std::string> >& list) const
+{
+  std::ifstream file(filename.c_str());
+  if (!file.is_open()) return false;
+
+  std::string line;
+  while(std::getline(file, line))
+  {
+    if (line.empty() || line[0] == '#') continue;
+    
+    std::istringstream is(line);
+    double stamp;
+    std::string path;
+    if (!(is >> stamp >> path)) continue;
+    
+    list.push_back(std::make_pair(stamp, dataset_path_ + "/" + path));
+  }
+
+  return !list.empty();
+}
+
+bool VOBenchmark::readTrajectory(
+  const std::string& filename,
+  StampedPoseVector& trajectory) const
+{
+  std::ifstream file(filename.c_str());
+  if (!file.is_open()) return false;
+
+  std::string line;
+  while(std::getline(file, line))
+  {
+    if (line.empty() || line[0] == '#') continue;
+    
+    std::istringstream is(line);
+    double stamp, x, y, z, qx, qy, qz, qw;
+    if (!(is >> stamp >> x >> y >> z >> qx >> qy >> qz >> qw)) continue;
+    
+    StampedPose stamped_pose;
+    stamped_pose.stamp = stamp;
+    stamped_pose.pose = 
+      Eigen::Translation3f(x, y, z) * Eigen::Quaternionf(qw, qx, qy, qz);
+    trajectory.push_back(stamped_pose);
+  }
+
+  return !trajectory.empty();
+}
+
+void VOBenchmark::associate(
+  const std::vector<std::pair<double, std::string> >& rgb_list,
+  const std::vector<std::pair<double, std::string> >& depth_list,
+  std::vector<ImagePair>& pairs) const
+{
+  // both lists are sorted by stamp
+  unsigned int d_idx = 0;
+  for (unsigned int r_idx = 0; r_idx < rgb_list.size(); ++r_idx)
+  {
+    double stamp = rgb_list[r_idx].first;
+    
+    while (d_idx + 1 < depth_list.size() &&
+           std::abs(depth_list[d_idx + 1].first - stamp) <= 
+           std::abs(depth_list[d_idx].first - stamp))
+      ++d_idx;
+
+    if (std::abs(depth_list[d_idx].first - stamp) > max_time_diff_) continue;
+    
+    ImagePair pair;
+    pair.stamp = stamp;
+    pair.rgb_file = rgb_list[r_idx].second;
+    pair.depth_file = depth_list[d_idx].second;
+    pairs.push_back(pair);
+  }
+}
+
+bool VOBenchmark::createFrame(
+  const ImagePair& pair, 
+  int index,
+  rgbdtools::RGBDFrame& frame) const
+{
+  cv::Mat rgb_img = cv::imread(pair.rgb_file, CV_LOAD_IMAGE_COLOR);
+  cv::Mat depth_raw = cv::imread(pair.depth_file, CV_LOAD_IMAGE_ANYDEPTH);
+  
+  if (rgb_img.empty() || depth_raw.empty()) return false;
+  
+  // convert to 16UC1 depth in mm, as expected by RGBDFrame
+  cv::Mat depth_img;
+  depth_raw.convertTo(depth_img, CV_16UC1, 1000.0 / depth_factor_);
+  
+  cv::Mat intr = cv::Mat::zeros(3, 3, CV_64FC1);
+  intr.at<double>(0, 0) = fx_;
+  intr.at<double>(1, 1) = fy_;
+  intr.at<double>(0, 2) = cx_;
+  intr.at<double>(1, 2) = cy_;
+  intr.at<double>(2, 2) = 1.0;
+  
+  rgbdtools::Header header;
+  header.seq        = index;
+  header.frame_id   = "camera";
+  header.stamp.sec  = (int)pair.stamp;
+  header.stamp.nsec = (int)((pair.stamp - header.stamp.sec) * 1e9);
+
+  frame = rgbdtools::RGBDFrame(rgb_img, depth_img, intr, header);
+  frame.index = index;
+  
+  return true;
+}
+
+bool VOBenchmark::saveTrajectory(
+  const std::string& filename,
+  const StampedPoseVector& trajectory) const
+{
+  FILE * file = fopen(filename.c_str(), "w");
+  if (file == NULL) return false;
+
+  fprintf(file, "# stamp x y z qx qy qz qw\n");
+
+  for (unsigned int idx = 0; idx < trajectory.size(); ++idx)
+  {
+    const AffineTransform& pose = trajectory[idx].pose;
+    Eigen::Quaternionf q(pose.rotation());
+    
+    fprintf(file, "%.6f %f %f %f %f %f %f %f\n",
+      trajectory[idx].stamp, 
+      pose.translation().x(), pose.translation().y(), pose.translation().z(),
+      q.x(), q.y(), q.z(), q.w());
+  }
+
+  fclose(file);
+  return true;
+}
+
+bool VOBenchmark::findClosest(
+  const StampedPoseVector& trajectory,
+  double stamp,
+  AffineTransform& pose) const
+{
+  // binary search for the first pose not earlier than the stamp
+  int lo = 0, hi = trajectory.size();
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (trajectory[mid].stamp < stamp) lo = mid + 1;
+    else hi = mid;
+  }
+
+  int best = -1;
+  double best_diff = max_time_diff_;
+  for (int idx = lo - 1; idx <= lo; ++idx)
+  {
+    if (idx < 0 || idx >= (int)trajectory.size()) continue;
+    double diff = std::abs(trajectory[idx].stamp - stamp);
+    if (diff <= best_diff)
+    {
+      best = idx;
+      best_diff = diff;
+    }
+  }
+
+  if (best < 0) return false;
+  pose = trajectory[best].pose;
+  return true;
+}
+
+int VOBenchmark::computeATE(
+  const StampedPoseVector& estimate,
+  const StampedPoseVector& groundtruth,
+  double& ate_rmse) const
+{
+  std::vector<Eigen::Vector3f> est_pts, gt_pts;
+  
+  for (unsigned int idx = 0; idx < estimate.size(); ++idx)
+  {
+    AffineTransform gt_pose;
+    if (!findClosest(groundtruth, estimate[idx].stamp, gt_pose)) continue;
+    
+    est_pts.push_back(estimate[idx].pose.translation());
+    gt_pts.push_back(gt_pose.translation());
+  }
+
+  int n = est_pts.size();
+  if (n < 3) return 0;
+
+  Eigen::Matrix3Xf est_mat(3, n), gt_mat(3, n);
+  for (int idx = 0; idx < n; ++idx)
+  {
+    est_mat.col(idx) = est_pts[idx];
+    gt_mat.col(idx)  = gt_pts[idx];
+  }
+
+  // rigid alignment (no scale) of the estimate to the ground truth
+  Eigen::Matrix4f align = Eigen::umeyama(est_mat, gt_mat, false);
+  Eigen::Matrix3Xf aligned = 
+    (align.block<3,3>(0,0) * est_mat).colwise() + align.block<3,1>(0,3);
+
+  ate_rmse = std::sqrt((aligned - gt_mat).colwise().squaredNorm().sum() / n);
+  return n;
+}
+
+int VOBenchmark::computeRPE(
+  const StampedPoseVector& estimate,
+  const StampedPoseVector& groundtruth,
+  double& rpe_trans_rmse, 
+  double& rpe_rot_rmse) const
+{
+  double sum_trans_sq = 0.0, sum_rot_sq = 0.0;
+  int n = 0;
+  
+  for (unsigned int idx = 1; idx < estimate.size(); ++idx)
+  {
+    AffineTransform gt_a, gt_b;
+    if (!findClosest(groundtruth, estimate[idx-1].stamp, gt_a) ||
+        !findClosest(groundtruth, estimate[idx].stamp, gt_b)) continue;
+    
+    AffineTransform est_delta = estimate[idx-1].pose.inverse() * estimate[idx].pose;
+    AffineTransform gt_delta = gt_a.inverse() * gt_b;
+    AffineTransform error = gt_delta.inverse() * est_delta;
+    
+    double angle = Eigen::AngleAxisf(error.rotation()).angle() * 180.0 / M_PI;
+    
+    sum_trans_sq += error.translation().squaredNorm();
+    sum_rot_sq += angle * angle;
+    ++n;
+  }
+
+  if (n == 0) return 0;
+  
+  rpe_trans_rmse = std::sqrt(sum_trans_sq / n);
+  rpe_rot_rmse   = std::sqrt(sum_rot_sq / n);
+  return n;
+}
+
+void VOBenchmark::printStage(
+  const std::string& name, 
+  const LatencyHistogram& hist) const
+{
+  double p50, p90, p99, max;
+  hist.getPercentiles(p50, p90, p99, max);
+  printf("  %-16s %8.2f %8.2f %8.2f %8.2f\n", 
+    name.c_str(), p50, p90, p99, max);
+}
+
+} // namespace ccny_rgbd
@@ -0,0 +1,89 @@
+/**
+ *  @file async_file_writer.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/async_file_writer.h"
+
+namespace ccny_rgbd {
+
+AsyncFileWriter::AsyncFileWriter(const std::string& filename):
+  shutdown_(false)
+{
+  file_ = fopen(filename.c_str(), "w");
+  
+  if (file_ != NULL)
+    thread_ = boost::thread(boost::bind(&AsyncFileWriter::writerThread, this));
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+  if (file_ == NULL) return;
+
+  mutex_.lock();
+  shutdown_ = true;
+  cond_.notify_one();
+  mutex_.unlock();
+
+  thread_.join();
+  fclose(file_);
+}
+
+void AsyncFileWriter::write(const std::string& line)
+{
+  if (file_ == NULL) return;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  pending_.push_back(line);
+}
+
+void AsyncFileWriter::writerThread()
+{
+  std::vector<std::string> lines;
+
+  while(true)
+  {
+    bool done;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      
+      // writes are batched: wake up once per second, or on shutdown
+      if (!shutdown_)
+        cond_.timed_wait(lock, boost::posix_time::seconds(1));
+      
+      lines.swap(pending_);
+      done = shutdown_;
+    }
+
+    for (unsigned int i = 0; i < lines.size(); ++i)
+    {
+      fputs(lines[i].c_str(), file_);
+      fputc('\n', file_);
+    }
+    if (!lines.empty()) fflush(file_);
+    lines.clear();
+
+    if (done) break;
+  }
+}
+
+} // namespace ccny_rgbd
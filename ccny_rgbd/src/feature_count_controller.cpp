@@ -0,0 +1,151 @@
+/**
+ *  @file feature_count_controller.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/feature_count_controller.h"
+
+#include <algorithm>
+
+namespace ccny_rgbd {
+
+FeatureCountController::FeatureCountController():
+  budget_(0.0),
+  min_features_(50),
+  max_features_(1000),
+  min_threshold_(5.0),
+  max_threshold_(100.0),
+  min_valid_(0),
+  alpha_(0.2),
+  max_step_(0.1),
+  control_count_(true),
+  control_threshold_(false),
+  n_features_(400.0),
+  threshold_(31.0),
+  d_avg_(0.0),
+  has_avg_(false)
+{
+
+}
+
+void FeatureCountController::setBudget(double budget)
+{
+  budget_ = budget;
+}
+
+void FeatureCountController::setFeatureCountRange(int min_features, int max_features)
+{
+  min_features_ = min_features;
+  max_features_ = std::max(min_features, max_features);
+}
+
+void FeatureCountController::setThresholdRange(double min_threshold, double max_threshold)
+{
+  min_threshold_ = min_threshold;
+  max_threshold_ = std::max(min_threshold, max_threshold);
+}
+
+void FeatureCountController::setMinValid(int min_valid)
+{
+  min_valid_ = min_valid;
+}
+
+void FeatureCountController::setSmoothing(double alpha)
+{
+  alpha_ = std::min(1.0, std::max(0.01, alpha));
+}
+
+void FeatureCountController::setControlled(bool feature_count, bool threshold)
+{
+  control_count_ = feature_count;
+  control_threshold_ = threshold;
+}
+
+void FeatureCountController::reset(int n_features, double threshold)
+{
+  n_features_ = n_features;
+  threshold_ = threshold;
+  has_avg_ = false;
+}
+
+bool FeatureCountController::update(
+  double d_features, double d_reg, int n_keypoints, int n_valid)
+{
+  if (!isEnabled()) return false;
+
+  int n_features_old = getFeatureCount();
+  double threshold_old = threshold_;
+
+  // **** smooth the measured duration
+
+  double d = d_features + d_reg;
+  d_avg_ = has_avg_ ? alpha_ * d + (1.0 - alpha_) * d_avg_ : d;
+  has_avg_ = true;
+
+  // **** bounded step towards the budget
+  
+  double scale = budget_ / std::max(d_avg_, 1e-3);
+  scale = std::min(1.0 + max_step_, std::max(1.0 - max_step_, scale));
+
+  // never starve the registration of correspondences
+  bool starved = n_valid < min_valid_;
+  if (starved) scale = 1.0 + max_step_;
+
+  if (control_count_)
+  {
+    n_features_ *= scale;
+    n_features_ = std::min((double)max_features_, 
+                  std::max((double)min_features_, n_features_));
+  }
+
+  if (control_threshold_)
+  {
+    // on target within a deadband
+    bool over  = scale < 1.0 - 0.5 * max_step_;
+    bool under = scale > 1.0 + 0.5 * max_step_;
+    
+    bool lower, raise;
+    if (control_count_)
+    {
+      // the count does the budget tracking: the threshold makes sure 
+      // the count is reachable, and takes over at the minimum count
+      lower = n_keypoints < 0.9 * n_features_;
+      raise = over && n_features_ <= min_features_;
+    }
+    else
+    {
+      // the threshold is the only knob
+      lower = starved || under;
+      raise = over;
+    }
+
+    if (lower)
+      threshold_ *= 1.0 - max_step_;
+    else if (raise)
+      threshold_ *= 1.0 + max_step_;
+    
+    threshold_ = std::min(max_threshold_, std::max(min_threshold_, threshold_));
+  }
+
+  return getFeatureCount() != n_features_old || threshold_ != threshold_old;
+}
+
+} // namespace ccny_rgbd
@@ -0,0 +1,395 @@
+/**
+ *  @file keyframe_image_store.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/keyframe_image_store.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ros/ros.h>
+#include <boost/make_shared.hpp>
+
+namespace ccny_rgbd {
+
+/** @brief pwrite() until all the data is written
+ */
+static bool writeAll(int fd, const uchar* data, size_t size, off_t offset)
+{
+  while (size > 0)
+  {
+    ssize_t n = pwrite(fd, data, size, offset);
+    if (n <= 0) return false;
+    data += n; size -= n; offset += n;
+  }
+  return true;
+}
+
+/** @brief pread() until all the data is read
+ */
+static bool readAll(int fd, uchar* data, size_t size, off_t offset)
+{
+  while (size > 0)
+  {
+    ssize_t n = pread(fd, data, size, offset);
+    if (n <= 0) return false;
+    data += n; size -= n; offset += n;
+  }
+  return true;
+}
+
+KeyframeImageStore::KeyframeImageStore(int cache_size):
+  cache_size_(cache_size),
+  rgb_lossless_(false),
+  jpeg_quality_(95),
+  compressed_bytes_(0),
+  memory_budget_(0),
+  read_ahead_(0),
+  spill_fd_(-1),
+  spill_size_(0),
+  resident_bytes_(0),
+  last_index_(-1)
+{
+
+}
+
+KeyframeImageStore::~KeyframeImageStore()
+{
+  if (spill_fd_ >= 0) close(spill_fd_);
+}
+
+void KeyframeImageStore::setCacheSize(int cache_size)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  cache_size_ = cache_size;
+  trimCache();
+}
+
+void KeyframeImageStore::setRgbCoding(bool lossless, int jpeg_quality)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  rgb_lossless_ = lossless;
+  jpeg_quality_ = jpeg_quality;
+}
+
+bool KeyframeImageStore::setSpill(
+  size_t memory_budget, const std::string& spill_dir, int read_ahead)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (spill_fd_ < 0)
+  {
+    std::string filename = spill_dir + "/ccny_rgbd_keyframes_XXXXXX";
+    std::vector<char> buffer(filename.begin(), filename.end());
+    buffer.push_back('\0');
+    
+    spill_fd_ = mkstemp(&buffer[0]);
+    if (spill_fd_ < 0) return false;
+    
+    // the file is removed as soon as it is closed
+    unlink(&buffer[0]);
+  }
+
+  memory_budget_ = memory_budget;
+  read_ahead_ = read_ahead;
+  trimResident();
+  return true;
+}
+
+int KeyframeImageStore::add(const cv::Mat& rgb, const cv::Mat& depth)
+{
+  std::vector<int> rgb_params;
+  std::string rgb_ext;
+
+  mutex_.lock();
+  if (rgb_lossless_)
+  {
+    rgb_ext = ".png";
+    rgb_params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+    rgb_params.push_back(1);
+  }
+  else
+  {
+    rgb_ext = ".jpg";
+    rgb_params.push_back(CV_IMWRITE_JPEG_QUALITY);
+    rgb_params.push_back(jpeg_quality_);
+  }
+  mutex_.unlock();
+
+  // low compression levels are much faster, and 
+  // compress depth images almost as well
+  std::vector<int> depth_params;
+  depth_params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+  depth_params.push_back(1);
+
+  // encode outside the lock, so that other threads can keep decoding
+  boost::shared_ptr<Entry> entry = boost::make_shared<Entry>();
+  encode(rgb,   rgb_ext, rgb_params,   entry->rgb);
+  encode(depth, ".png",  depth_params, entry->depth);
+  entry->spilled = false;
+  entry->file_offset = 0;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  
+  int index = entries_.size();
+  entries_.push_back(entry);
+  
+  size_t bytes = entry->rgb.size + entry->depth.size;
+  compressed_bytes_ += bytes;
+  resident_bytes_ += bytes;
+  
+  resident_lru_.push_front(index);
+  resident_its_[index] = resident_lru_.begin();
+  trimResident();
+  
+  return index;
+}
+
+bool KeyframeImageStore::get(int index, cv::Mat& rgb, cv::Mat& depth)
+{
+  EntryPtr entry;
+  
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    
+    if (index < 0 || index >= (int)entries_.size()) return false;
+
+    // sequential access: read the following spilled images ahead
+    if (index == last_index_ + 1) 
+      readAhead(index + 1, index + read_ahead_);
+    last_index_ = index;
+    
+    // mark the compressed data as recently used
+    boost::unordered_map<int, std::list<int>::iterator>::iterator res_it = 
+      resident_its_.find(index);
+    if (res_it != resident_its_.end())
+      resident_lru_.splice(resident_lru_.begin(), resident_lru_, res_it->second);
+
+    if (getCached(index, rgb, depth)) return true;
+    entry = entries_[index];
+  }
+
+  // read and decode outside the lock, so that several 
+  // threads can do it at once
+  if (entry->spilled)
+  {
+    boost::shared_ptr<Entry> loaded = boost::make_shared<Entry>();
+    if (!readSpilled(*entry, *loaded)) 
+    {
+      ROS_ERROR("Reading keyframe images %d from the spill file failed", index);
+      return false;
+    }
+    entry = loaded;
+  }
+
+  CacheEntry cache_entry;
+  decode(entry->rgb,   cache_entry.rgb);
+  decode(entry->depth, cache_entry.depth);
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  // another thread may have decoded the same images meanwhile
+  if (getCached(index, rgb, depth)) return true;
+
+  lru_.push_front(index);
+  cache_entry.lru_it = lru_.begin();
+  cache_[index] = cache_entry;
+  trimCache();
+
+  rgb   = cache_entry.rgb;
+  depth = cache_entry.depth;
+  return true;
+}
+
+bool KeyframeImageStore::getCached(int index, cv::Mat& rgb, cv::Mat& depth)
+{
+  Cache::iterator it = cache_.find(index);
+  if (it == cache_.end()) return false;
+
+  // move to the front of the LRU list
+  lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+  rgb   = it->second.rgb;
+  depth = it->second.depth;
+  return true;
+}
+
+void KeyframeImageStore::clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  entries_.clear();
+  cache_.clear();
+  lru_.clear();
+  resident_lru_.clear();
+  resident_its_.clear();
+  compressed_bytes_ = 0;
+  resident_bytes_ = 0;
+  last_index_ = -1;
+
+  if (spill_fd_ >= 0 && ftruncate(spill_fd_, 0) == 0)
+    spill_size_ = 0;
+}
+
+int KeyframeImageStore::size()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return entries_.size();
+}
+
+size_t KeyframeImageStore::getCompressedBytes()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return compressed_bytes_;
+}
+
+size_t KeyframeImageStore::getResidentBytes()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return resident_bytes_;
+}
+
+void KeyframeImageStore::encode(
+  const cv::Mat& image, const std::string& ext,
+  const std::vector<int>& params, CodedImage& coded)
+{
+  coded.rows = image.rows;
+  coded.cols = image.cols;
+  coded.type = image.type();
+  
+  // PNG supports 8 and 16 bit images, JPEG only 8 bit
+  bool codable = !image.empty() && 
+    (image.depth() == CV_8U || (image.depth() == CV_16U && ext == ".png"));
+  
+  coded.raw = !codable || !cv::imencode(ext, image, coded.data, params);
+  
+  if (coded.raw)
+  {
+    cv::Mat continuous = image.isContinuous() ? image : image.clone();
+    const uchar* begin = continuous.data;
+    const uchar* end = begin + continuous.total() * continuous.elemSize();
+    coded.data.assign(begin, end);
+  }
+
+  coded.size = coded.data.size();
+}
+
+void KeyframeImageStore::decode(const CodedImage& coded, cv::Mat& image)
+{
+  if (coded.raw)
+  {
+    image.create(coded.rows, coded.cols, coded.type);
+    if (!coded.data.empty())
+      memcpy(image.data, &coded.data[0], coded.data.size());
+  }
+  else
+  {
+    image = cv::imdecode(coded.data, CV_LOAD_IMAGE_UNCHANGED);
+  }
+}
+
+void KeyframeImageStore::trimCache()
+{
+  while ((int)lru_.size() > std::max(cache_size_, 0))
+  {
+    cache_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+void KeyframeImageStore::trimResident()
+{
+  if (spill_fd_ < 0 || memory_budget_ == 0) return;
+
+  while (resident_bytes_ > memory_budget_ && !resident_lru_.empty())
+  {
+    int index = resident_lru_.back();
+    const Entry& entry = *entries_[index];
+
+    // append the rgb and depth data to the spill file
+    off_t offset = spill_size_;
+    if (!writeAll(spill_fd_, dataPtr(entry.rgb), entry.rgb.size, offset) ||
+        !writeAll(spill_fd_, dataPtr(entry.depth), entry.depth.size, 
+                  offset + entry.rgb.size))
+    {
+      ROS_ERROR("Writing to the keyframe spill file failed, "
+        "keeping all keyframe images in memory");
+      memory_budget_ = 0;
+      return;
+    }
+    spill_size_ += entry.rgb.size + entry.depth.size;
+
+    // replace the entry by one without the data. Threads still 
+    // decoding the old entry keep it alive until they are done.
+    boost::shared_ptr<Entry> spilled = boost::make_shared<Entry>();
+    spilled->rgb.size   = entry.rgb.size;
+    spilled->rgb.raw    = entry.rgb.raw;
+    spilled->rgb.rows   = entry.rgb.rows;
+    spilled->rgb.cols   = entry.rgb.cols;
+    spilled->rgb.type   = entry.rgb.type;
+    spilled->depth.size = entry.depth.size;
+    spilled->depth.raw  = entry.depth.raw;
+    spilled->depth.rows = entry.depth.rows;
+    spilled->depth.cols = entry.depth.cols;
+    spilled->depth.type = entry.depth.type;
+    spilled->spilled = true;
+    spilled->file_offset = offset;
+
+    resident_bytes_ -= entry.rgb.size + entry.depth.size;
+    entries_[index] = spilled;
+    
+    resident_its_.erase(index);
+    resident_lru_.pop_back();
+  }
+}
+
+bool KeyframeImageStore::readSpilled(const Entry& entry, Entry& loaded)
+{
+  loaded = entry;
+  loaded.spilled = false;
+  loaded.rgb.data.resize(entry.rgb.size);
+  loaded.depth.data.resize(entry.depth.size);
+
+  return 
+    readAll(spill_fd_, dataPtr(loaded.rgb), entry.rgb.size, 
+            entry.file_offset) &&
+    readAll(spill_fd_, dataPtr(loaded.depth), entry.depth.size, 
+            entry.file_offset + entry.rgb.size);
+}
+
+void KeyframeImageStore::readAhead(int first, int last)
+{
+  if (spill_fd_ < 0) return;
+
+  last = std::min(last, (int)entries_.size() - 1);
+  for (int index = first; index <= last; ++index)
+  {
+    const Entry& entry = *entries_[index];
+    if (entry.spilled)
+    {
+      posix_fadvise(spill_fd_, entry.file_offset, 
+        entry.rgb.size + entry.depth.size, POSIX_FADV_WILLNEED);
+    }
+  }
+}
+
+} // namespace ccny_rgbd
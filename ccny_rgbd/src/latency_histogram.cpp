@@ -0,0 +1,65 @@
+/**
+ *  @file latency_histogram.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/latency_histogram.h"
+
+#include <algorithm>
+
+namespace ccny_rgbd {
+
+LatencyHistogram::LatencyHistogram(int window_size):
+  samples_(std::max(window_size, 1), 0.0),
+  count_(0),
+  next_(0)
+{
+  sorted_.reserve(samples_.size());
+}
+
+void LatencyHistogram::add(double value)
+{
+  samples_[next_] = value;
+  next_ = (next_ + 1) % samples_.size();
+  if (count_ < (int)samples_.size()) count_++;
+}
+
+void LatencyHistogram::getPercentiles(
+  double& p50, double& p90, double& p99, double& max) const
+{
+  if (count_ == 0)
+  {
+    p50 = p90 = p99 = max = 0.0;
+    return;
+  }
+
+  sorted_.assign(samples_.begin(), samples_.begin() + count_);
+  std::sort(sorted_.begin(), sorted_.end());
+
+  // nearest-rank percentiles
+  int last = count_ - 1;
+  p50 = sorted_[(int)(0.50 * last + 0.5)];
+  p90 = sorted_[(int)(0.90 * last + 0.5)];
+  p99 = sorted_[(int)(0.99 * last + 0.5)];
+  max = sorted_[last];
+}
+
+} // namespace ccny_rgbd
@@ -0,0 +1,371 @@
+/**
+ *  @file motion_estimation_icp_prob_model_voxel.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/motion_estimation_icp_prob_model_voxel.h"
+
+#include <pcl/common/transforms.h>
+
+#include "ccny_rgbd/util.h"
+
+namespace ccny_rgbd {
+
+MotionEstimationICPProbModelVoxel::MotionEstimationICPProbModelVoxel():
+  MotionEstimation(),
+  model_idx_(0),
+  model_size_(0)
+{
+  // params
+  setMaxIterations(10);
+  setMinCorrespondences(15);
+  setNNearestNeighbors(4);
+  setMaxModelSize(3000);
+  setTfEpsilonLinear(1e-4);
+  setTfEpsilonAngular(1.7e-3);
+  setMaxAssociationDistMahalanobis(10.0);
+  setMaxCorrespondenceDistEuclidean(0.15);
+
+  // state variables
+  model_ptr_.reset(new PointCloudFeature());
+
+  f2b_.setIdentity(); 
+  I_.setIdentity();
+}
+
+MotionEstimationICPProbModelVoxel::~MotionEstimationICPProbModelVoxel()
+{
+
+}
+
+void MotionEstimationICPProbModelVoxel::setMaxIterations(int max_iterations)
+{
+  max_iterations_ = max_iterations;
+}
+
+void MotionEstimationICPProbModelVoxel::setMinCorrespondences(int min_correspondences)
+{
+  min_correspondences_ = min_correspondences;
+}
+
+void MotionEstimationICPProbModelVoxel::setNNearestNeighbors(int n_nearest_neighbors)
+{
+  n_nearest_neighbors_ = n_nearest_neighbors;
+}
+
+void MotionEstimationICPProbModelVoxel::setMaxModelSize(int max_model_size)
+{
+  max_model_size_ = max_model_size;
+}
+
+void MotionEstimationICPProbModelVoxel::setTfEpsilonLinear(double tf_epsilon_linear)
+{
+  tf_epsilon_linear_ = tf_epsilon_linear;
+}
+
+void MotionEstimationICPProbModelVoxel::setTfEpsilonAngular(double tf_epsilon_angular)
+{
+  tf_epsilon_angular_ = tf_epsilon_angular;
+}
+
+void MotionEstimationICPProbModelVoxel::setMaxAssociationDistMahalanobis(double max_assoc_dist_mah)
+{
+  max_assoc_dist_mah_ = max_assoc_dist_mah;
+  max_assoc_dist_mah_sq_ = max_assoc_dist_mah * max_assoc_dist_mah;
+}
+
+void MotionEstimationICPProbModelVoxel::setMaxCorrespondenceDistEuclidean(double max_corresp_dist_eucl)
+{
+  max_corresp_dist_eucl_ = max_corresp_dist_eucl;
+  max_corresp_dist_eucl_sq_ = max_corresp_dist_eucl * max_corresp_dist_eucl;
+
+  // re-index the model with the new voxel size
+  model_index_.setVoxelSize(max_corresp_dist_eucl);
+  for (int idx = 0; idx < model_size_; ++idx)
+    model_index_.insert(idx, means_[idx]);
+}
+
+bool MotionEstimationICPProbModelVoxel::getMotionEstimationImpl(
+  rgbdtools::RGBDFrame& frame,
+  const AffineTransform& prediction,
+  AffineTransform& motion)
+{
+  /// @todo: currently ignores prediction
+  bool result;
+
+  // remove nans from distributions
+  data_means_.clear();
+  data_covariances_.clear();
+  removeInvalidDistributions(
+    frame.kp_means, frame.kp_covariances, frame.kp_valid,
+    data_means_, data_covariances_);
+   
+  // transform distributions to world frame
+  transformDistributions(data_means_, data_covariances_, f2b_ * b2c_);
+       
+  // **** perform registration
+
+  if (model_size_ == 0)
+  {
+    ROS_INFO("No points in model: initializing from features.");
+    motion.setIdentity();
+    initializeModelFromData(data_means_, data_covariances_);
+    result = true;
+  }
+  else
+  {
+    // align using icp 
+    result = alignICPEuclidean(data_means_, motion);
+
+    if (!result) return false;
+
+    constrainMotion(motion);
+    f2b_ = motion * f2b_;
+    
+    // transform distributions to world frame
+    transformDistributions(data_means_, data_covariances_, motion);
+
+    // update model: inserts new features and updates old ones with KF
+    updateModelFromData(data_means_, data_covariances_);
+  }
+
+  model_ptr_->width = model_ptr_->points.size();
+
+  return result;
+}
+
+bool MotionEstimationICPProbModelVoxel::alignICPEuclidean(
+  const Vector3fVector& data_means,
+  AffineTransform& correction)
+{
+  TransformationEstimationSVD svd;
+
+  // create a point cloud from the means
+  data_cloud_.points.resize(data_means.size());
+  for (unsigned int idx = 0; idx < data_means.size(); ++idx)
+  {
+    const Vector3f& mean = data_means[idx];
+    data_cloud_.points[idx].x = mean(0);
+    data_cloud_.points[idx].y = mean(1);
+    data_cloud_.points[idx].z = mean(2);
+  }
+  data_cloud_.width = data_cloud_.points.size();
+  data_cloud_.height = 1;
+
+  // initialize the result transform
+  AffineTransform final_transformation; 
+  final_transformation.setIdentity();
+  
+  for (int iteration = 0; iteration < max_iterations_; ++iteration)
+  {    
+    // get corespondences
+    getCorrespEuclidean(data_cloud_, data_indices_, model_indices_);
+   
+    if ((int)data_indices_.size() < min_correspondences_)
+    {
+      ROS_WARN("[ICP] Not enough correspondences (%d of %d minimum). Leaving ICP loop",
+        (int)data_indices_.size(), min_correspondences_);
+      return false;
+    }
+
+    // estimate transformation
+    Eigen::Matrix4f transform_eigen; 
+    svd.estimateRigidTransformation (
+      data_cloud_, data_indices_,
+      *model_ptr_, model_indices_,
+      transform_eigen);
+    
+    // compute the delta from this iteration
+    AffineTransform transform(transform_eigen);
+    
+    final_transformation = transform * final_transformation;
+
+    // transform the data cloud
+    pcl::transformPointCloud(data_cloud_, data_cloud_, transform_eigen);
+
+    // check for convergence
+    double linear, angular;
+    getTfDifference(tfFromEigenAffine(transform), linear, angular);
+    if (linear  < tf_epsilon_linear_ && 
+        angular < tf_epsilon_angular_)
+      break; 
+  }
+
+  correction = final_transformation;
+  return true;
+}
+
+void MotionEstimationICPProbModelVoxel::getCorrespEuclidean(
+  const PointCloudFeature& data_cloud,
+  IntVector& data_indices,
+  IntVector& model_indices)
+{
+  data_indices.clear();
+  model_indices.clear();
+
+  for (unsigned int data_idx = 0; data_idx < data_cloud.size(); ++data_idx)
+  {
+    const PointFeature& data_point = data_cloud.points[data_idx];
+    
+    int eucl_nn_idx;
+    double eucl_dist_sq;
+    
+    bool nn_result = model_index_.nearest(
+      Vector3f(data_point.x, data_point.y, data_point.z), means_,
+      eucl_nn_idx, eucl_dist_sq);
+    
+    if (nn_result && eucl_dist_sq < max_corresp_dist_eucl_sq_)
+    {
+      data_indices.push_back(data_idx);
+      model_indices.push_back(eucl_nn_idx);
+    }
+  }  
+}
+
+bool MotionEstimationICPProbModelVoxel::getNNMahalanobis(
+  const Vector3f& data_mean, const Matrix3f& data_cov,
+  int& mah_nn_idx, double& mah_dist_sq)
+{
+  int n_retrieved = model_index_.nearestK(
+    data_mean, means_, n_nearest_neighbors_, nn_indices_, nn_dists_sq_);
+
+  // iterate over Euclidean NNs to find Mah. NN
+  double best_mah_dist_sq = 0;
+  int best_mah_nn_idx = -1;
+  
+  for (int i = 0; i < n_retrieved; i++)
+  {
+    int nn_idx = nn_indices_[i];
+   
+    const Vector3f& model_mean = means_[nn_idx];
+    const Matrix3f& model_cov  = covariances_[nn_idx];
+
+    Vector3f diff_mat = model_mean - data_mean;
+    Matrix3f sum_cov = model_cov + data_cov; 
+    Matrix3f sum_cov_inv = sum_cov.inverse();
+
+    Eigen::Matrix<float,1,1> mah_mat = diff_mat.transpose() * sum_cov_inv * diff_mat;
+
+    double mah_dist_sq_i = mah_mat(0,0);
+
+    if (best_mah_nn_idx == -1 || mah_dist_sq_i < best_mah_dist_sq)
+    {
+      best_mah_dist_sq = mah_dist_sq_i;
+      best_mah_nn_idx  = nn_idx;
+    }
+  }
+
+  if (best_mah_nn_idx != -1)
+  {
+    mah_dist_sq = best_mah_dist_sq;
+    mah_nn_idx  = best_mah_nn_idx;
+    return true;
+  }
+  else return false;
+}
+
+void MotionEstimationICPProbModelVoxel::initializeModelFromData(
+  const Vector3fVector& data_means,
+  const Matrix3fVector& data_covariances)
+{
+  for (unsigned int idx = 0; idx < data_means.size(); ++idx)
+    addToModel(data_means[idx], data_covariances[idx]);
+}
+
+void MotionEstimationICPProbModelVoxel::updateModelFromData(
+  const Vector3fVector& data_means,
+  const Matrix3fVector& data_covariances)
+{
+  for (unsigned int idx = 0; idx < data_means.size(); ++idx)
+  {
+    const Vector3f& data_mean = data_means[idx];
+    const Matrix3f& data_cov  = data_covariances[idx];
+    
+    int mah_nn_idx;
+    double mah_dist_sq;
+    bool nn_result = getNNMahalanobis(data_mean, data_cov, mah_nn_idx, mah_dist_sq);
+
+    if (nn_result && mah_dist_sq < max_assoc_dist_mah_sq_)
+    {
+      // **** KF update *********************************
+
+      Vector3f& model_mean = means_[mah_nn_idx];
+      Matrix3f& model_cov  = covariances_[mah_nn_idx];
+      
+      Matrix3f K = model_cov * (model_cov + data_cov).inverse();
+      Vector3f new_mean = model_mean + K * (data_mean - model_mean);
+
+      // the index only changes if the point leaves its voxel
+      model_index_.move(mah_nn_idx, model_mean, new_mean);
+
+      model_mean = new_mean;
+      model_cov  = (I_ - K) * model_cov;
+
+      PointFeature& model_point = model_ptr_->points[mah_nn_idx];
+      model_point.x = model_mean(0,0);
+      model_point.y = model_mean(1,0);
+      model_point.z = model_mean(2,0);
+    }
+    else
+    {
+      // **** add as new point **************************
+      
+      addToModel(data_mean, data_cov);
+    }
+  }
+}
+
+void MotionEstimationICPProbModelVoxel::addToModel(
+  const Vector3f& data_mean,
+  const Matrix3f& data_cov)
+{
+  PointFeature data_point;
+  data_point.x = data_mean(0,0);
+  data_point.y = data_mean(1,0);
+  data_point.z = data_mean(2,0);
+
+  if (model_size_ < max_model_size_)
+  { 
+    covariances_.push_back(data_cov);
+    means_.push_back(data_mean);
+    model_ptr_->points.push_back(data_point);
+    model_index_.insert(model_size_, data_mean);
+    
+    model_size_++;
+  }
+  else // model_size_ == max_model_size_
+  {   
+    if (model_idx_ >= max_model_size_)
+      model_idx_ = 0;
+
+    // replace the oldest point
+    model_index_.remove(model_idx_, means_[model_idx_]);
+    model_index_.insert(model_idx_, data_mean);
+
+    covariances_.at(model_idx_) = data_cov;
+    means_.at(model_idx_) = data_mean;
+    model_ptr_->points[model_idx_] = data_point;
+  }
+
+  model_idx_++;
+}
+
+} // namespace ccny_rgbd
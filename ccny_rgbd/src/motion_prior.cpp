@@ -0,0 +1,111 @@
+/**
+ *  @file motion_prior.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/motion_prior.h"
+
+namespace ccny_rgbd {
+
+// **** constant velocity ********************************************
+
+ConstantVelocityMotionPrior::ConstantVelocityMotionPrior():
+  n_poses_(0)
+{
+
+}
+
+bool ConstantVelocityMotionPrior::getPrediction(
+  const ros::Time& stamp,
+  const tf::Transform& f2b,
+  tf::Transform& f2b_pred)
+{
+  if (n_poses_ < 2) return false;
+  
+  double dt_prev = (stamp_last_ - stamp_prev_).toSec();
+  double dt      = (stamp       - stamp_last_).toSec();
+  if (dt_prev <= 0.0 || dt <= 0.0) return false;
+
+  // motion over the last interval, in the base frame, 
+  // scaled to the new interval
+  tf::Transform motion = f2b_prev_.inverse() * f2b_last_;
+  f2b_pred = f2b * scaleTransform(motion, dt / dt_prev);
+  return true;
+}
+
+void ConstantVelocityMotionPrior::update(
+  const ros::Time& stamp,
+  const tf::Transform& f2b)
+{
+  stamp_prev_ = stamp_last_;
+  f2b_prev_   = f2b_last_;
+  stamp_last_ = stamp;
+  f2b_last_   = f2b;
+
+  if (n_poses_ < 2) n_poses_++;
+}
+
+// **** odometry *****************************************************
+
+OdometryMotionPrior::OdometryMotionPrior(
+  ros::NodeHandle& nh, 
+  const std::string& topic,
+  double buffer_duration):
+  buffer_(buffer_duration),
+  has_last_(false)
+{
+  odom_subscriber_ = nh.subscribe(
+    topic, 100, &OdometryMotionPrior::odomCallback, this);
+}
+
+void OdometryMotionPrior::odomCallback(const OdomMsg::ConstPtr& odom_msg)
+{
+  tf::Transform pose;
+  tf::poseMsgToTF(odom_msg->pose.pose, pose);
+  buffer_.add(odom_msg->header.stamp, pose);
+}
+
+bool OdometryMotionPrior::getPrediction(
+  const ros::Time& stamp,
+  const tf::Transform& f2b,
+  tf::Transform& f2b_pred)
+{
+  if (!has_last_) return false;
+
+  tf::Transform odom_last, odom_new;
+  if (buffer_.lookup(stamp_last_, odom_last) != PoseBuffer::FOUND || 
+      buffer_.lookup(stamp,       odom_new)  != PoseBuffer::FOUND)
+    return false;
+  
+  // apply the odometry motion (in the base frame) to the last estimate
+  f2b_pred = f2b * (odom_last.inverse() * odom_new);
+  return true;
+}
+
+void OdometryMotionPrior::update(
+  const ros::Time& stamp,
+  const tf::Transform& f2b)
+{
+  stamp_last_ = stamp;
+  has_last_ = true;
+}
+
+} // namespace ccny_rgbd
@@ -0,0 +1,38 @@
+/**
+ *  @file vo_benchmark_node.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/apps/vo_benchmark.h"
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    printf("Usage: vo_benchmark_node _dataset:=<tum_dataset_dir> "
+           "[_output_file:=path.tum.txt] [_name:=value ...]\n");
+    return 1;
+  }
+  
+  ccny_rgbd::ArgParams params(argc, argv);
+  ccny_rgbd::VOBenchmark benchmark(params);
+  return benchmark.run() ? 0 : 1;
+}
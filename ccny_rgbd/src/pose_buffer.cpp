@@ -0,0 +1,106 @@
+/**
+ *  @file pose_buffer.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "ccny_rgbd/pose_buffer.h"
+
+namespace ccny_rgbd {
+
+tf::Transform scaleTransform(const tf::Transform& transform, double scale)
+{
+  tf::Quaternion q = transform.getRotation();
+  double angle = q.getAngle();
+
+  tf::Quaternion q_scaled = tf::createIdentityQuaternion();
+  if (angle > 1e-9)
+    q_scaled.setRotation(q.getAxis(), angle * scale);
+    
+  return tf::Transform(q_scaled, transform.getOrigin() * scale);
+}
+
+PoseBuffer::PoseBuffer(double duration):
+  duration_(duration)
+{
+
+}
+
+void PoseBuffer::setDuration(double duration)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  duration_ = ros::Duration(duration);
+}
+
+void PoseBuffer::add(const ros::Time& stamp, const tf::Transform& pose)
+{
+  StampedTf stamped_tf;
+  stamped_tf.stamp = stamp;
+  stamped_tf.pose  = pose;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  
+  // out of order poses reset the buffer (for example, bag restarts)
+  if (!buffer_.empty() && stamp < buffer_.back().stamp)
+    buffer_.clear();
+
+  buffer_.push_back(stamped_tf);
+  
+  while (buffer_.front().stamp + duration_ < stamp)
+    buffer_.pop_front();
+}
+
+PoseBuffer::LookupResult PoseBuffer::lookup(
+  const ros::Time& stamp, tf::Transform& pose) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (buffer_.empty() || stamp > buffer_.back().stamp) 
+    return NOT_AVAILABLE;
+  if (stamp < buffer_.front().stamp)
+    return TOO_OLD;
+
+  // find the first pose not earlier than the stamp
+  std::deque<StampedTf>::const_iterator it = std::lower_bound(
+    buffer_.begin(), buffer_.end(), stamp, stampLess);
+  
+  if (it == buffer_.begin() || it->stamp == stamp)
+  {
+    pose = it->pose;
+    return FOUND;
+  }
+  
+  const StampedTf& a = *(it - 1);
+  const StampedTf& b = *it;
+  
+  double t = (stamp - a.stamp).toSec() / (b.stamp - a.stamp).toSec();
+  pose = a.pose * scaleTransform(a.pose.inverse() * b.pose, t);
+  return FOUND;
+}
+
+void PoseBuffer::clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  buffer_.clear();
+}
+
+} // namespace ccny_rgbd
@@ -0,0 +1,167 @@
+/**
+ *  @file rgbd_frame_builder.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/rgbd_frame_builder.h"
+
+#include <limits>
+#include <cv_bridge/cv_bridge.h>
+
+#include "ccny_rgbd/util.h"
+
+namespace ccny_rgbd {
+
+RGBDFrameBuilder::RGBDFrameBuilder(int max_pool_size):
+  pool_(new Pool)
+{
+  pool_->max_size = max_pool_size;
+}
+
+RGBDFramePtr RGBDFrameBuilder::acquire()
+{
+  rgbdtools::RGBDFrame * frame = NULL;
+  
+  {
+    boost::mutex::scoped_lock lock(pool_->mutex);
+    if (!pool_->frames.empty())
+    {
+      frame = pool_->frames.back();
+      pool_->frames.pop_back();
+    }
+  }
+  
+  if (frame == NULL) frame = new rgbdtools::RGBDFrame();
+  
+  Recycler recycler;
+  recycler.pool = pool_;
+  return RGBDFramePtr(frame, recycler);
+}
+
+void RGBDFrameBuilder::Recycler::operator()(rgbdtools::RGBDFrame * frame)
+{
+  boost::mutex::scoped_lock lock(pool->mutex);
+  if ((int)pool->frames.size() < pool->max_size)
+    pool->frames.push_back(frame);
+  else
+    delete frame;
+}
+
+int RGBDFrameBuilder::getPoolSize() const
+{
+  boost::mutex::scoped_lock lock(pool_->mutex);
+  return pool_->frames.size();
+}
+
+void RGBDFrameBuilder::build(
+  const ImageMsg::ConstPtr& rgb_msg,
+  const ImageMsg::ConstPtr& depth_msg,
+  const CameraInfoMsg::ConstPtr& info_msg,
+  rgbdtools::RGBDFrame& frame)
+{
+  frame.rgb_img = cv_bridge::toCvShare(rgb_msg)->image;
+
+  // handles 16UC1 natively
+  // 32FC1 is converted into the 16UC1 buffer of the frame, unless 
+  // the buffer is still referenced by a previous user of the frame
+  const std::string& enc = depth_msg->encoding; 
+  if (enc.compare("16UC1") == 0)
+    frame.depth_img = cv_bridge::toCvShare(depth_msg)->image;
+  else if (enc.compare("32FC1") == 0)
+  {
+    if (!isUniqueBuffer(frame.depth_img)) frame.depth_img.release();
+    depthImageFloatTo16bitReuse(
+      cv_bridge::toCvShare(depth_msg)->image, frame.depth_img);
+  }
+
+  frame.intr = getIntrinsics(info_msg);
+  /// @todo assert that distortion is 0
+
+  frame.header.seq        = rgb_msg->header.seq;
+  frame.header.frame_id   = rgb_msg->header.frame_id;
+  frame.header.stamp.sec  = rgb_msg->header.stamp.sec;
+  frame.header.stamp.nsec = rgb_msg->header.stamp.nsec;
+
+  // clear any feature data from previous use, keeping the capacity
+  frame.keypoints.clear();
+  frame.kp_valid.clear();
+  frame.kp_means.clear();
+  frame.kp_covariances.clear();
+  frame.n_valid_keypoints = 0;
+}
+
+cv::Mat RGBDFrameBuilder::getIntrinsics(const CameraInfoMsg::ConstPtr& info_msg)
+{
+  boost::mutex::scoped_lock lock(intr_mutex_);
+
+  if (intr_.empty() || info_msg->K != cached_K_ || info_msg->D != cached_D_)
+  {
+    // allocate a new matrix: frames built earlier keep the old one
+    cv::Mat dist;
+    convertCameraInfoToMats(info_msg, intr_, dist);
+    cached_K_ = info_msg->K;
+    cached_D_ = info_msg->D;
+  }
+
+  return intr_;
+}
+
+void depthImageFloatTo16bitReuse(
+  const cv::Mat& depth_img_in, 
+  cv::Mat& depth_img_out)
+{
+  // no-op if the output already has the right size and type
+  depth_img_out.create(depth_img_in.size(), CV_16UC1);
+  
+  const uint16_t max_value = std::numeric_limits<uint16_t>::max();
+
+  for (int v = 0; v < depth_img_in.rows; ++v)
+  {
+    const float * in = depth_img_in.ptr<float>(v);
+    uint16_t * out = depth_img_out.ptr<uint16_t>(v);
+    
+    for (int u = 0; u < depth_img_in.cols; ++u)
+    {
+      float z_mm = in[u] * 1000.0f;
+      
+      // also true for NaN readings
+      if (!(z_mm > 0.0f))
+        out[u] = 0;
+      else if (z_mm >= max_value)
+        out[u] = max_value;
+      else
+        out[u] = (uint16_t)(z_mm + 0.5f);
+    }
+  }
+}
+
+bool isUniqueBuffer(const cv::Mat& mat)
+{
+  // a Mat without a reference count wraps external data (for example,
+  // the buffer of an image message shared by cv_bridge::toCvShare)
+#if CV_MAJOR_VERSION >= 3
+  return mat.u != NULL && mat.u->refcount == 1;
+#else
+  return mat.refcount != NULL && *mat.refcount == 1;
+#endif
+}
+
+} // namespace ccny_rgbd
@@ -0,0 +1,132 @@
+/**
+ *  @file thread_pool.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/thread_pool.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+
+namespace ccny_rgbd {
+
+ThreadPool::ThreadPool(int n_threads):
+  shutdown_(false)
+{
+  if (n_threads < 0)
+    n_threads = std::max(0, (int)boost::thread::hardware_concurrency() - 1);
+
+  for (int i = 0; i < n_threads; ++i)
+    threads_.push_back(new boost::thread(
+      boost::bind(&ThreadPool::workerThread, this)));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+    work_cond_.notify_all();
+  }
+
+  for (unsigned int i = 0; i < threads_.size(); ++i)
+  {
+    threads_[i]->join();
+    delete threads_[i];
+  }
+}
+
+void ThreadPool::run(int n_tasks, const Task& task)
+{
+  if (n_tasks <= 0) return;
+
+  Batch batch;
+  batch.task    = &task;
+  batch.n_tasks = n_tasks;
+  batch.next    = 0;
+  batch.n_done  = 0;
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  batches_.push_back(&batch);
+  work_cond_.notify_all();
+
+  // help with the tasks of this batch, then wait for the rest
+  while (batch.next < batch.n_tasks)
+  {
+    int task_idx = batch.next++;
+    if (batch.next == batch.n_tasks)
+      batches_.erase(std::find(batches_.begin(), batches_.end(), &batch));
+
+    lock.unlock();
+    task(task_idx);
+    lock.lock();
+    
+    finishTask(&batch);
+  }
+
+  while (batch.n_done < batch.n_tasks)
+    done_cond_.wait(lock);
+}
+
+bool ThreadPool::takeTask(Batch*& batch, int& task_idx)
+{
+  if (batches_.empty()) return false;
+
+  batch = batches_.front();
+  task_idx = batch->next++;
+  
+  // fully handed out batches leave the queue
+  if (batch->next == batch->n_tasks) batches_.pop_front();
+  
+  return true;
+}
+
+void ThreadPool::finishTask(Batch* batch)
+{
+  batch->n_done++;
+  if (batch->n_done == batch->n_tasks)
+    done_cond_.notify_all();
+}
+
+void ThreadPool::workerThread()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while(true)
+  {
+    Batch * batch;
+    int task_idx;
+
+    while (!shutdown_ && !takeTask(batch, task_idx))
+      work_cond_.wait(lock);
+
+    if (shutdown_) return;
+
+    lock.unlock();
+    (*batch->task)(task_idx);
+    lock.lock();
+
+    finishTask(batch);
+  }
+}
+
+} // namespace ccny_rgbd
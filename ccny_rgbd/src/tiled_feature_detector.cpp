@@ -0,0 +1,149 @@
+/**
+ *  @file tiled_feature_detector.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/tiled_feature_detector.h"
+
+#include <boost/bind.hpp>
+
+namespace ccny_rgbd {
+
+TiledFeatureDetector::TiledFeatureDetector(
+  int rows, int cols, int overlap, 
+  const boost::shared_ptr<ThreadPool>& pool):
+  rows_(std::max(rows, 1)),
+  cols_(std::max(cols, 1)),
+  overlap_(std::max(overlap, 0)),
+  pool_(pool),
+  frame_(NULL)
+{
+  tile_frames_.resize(getNumTiles());
+  intrs_.resize(getNumTiles());
+}
+
+void TiledFeatureDetector::setDetectors(
+  const std::vector<rgbdtools::FeatureDetectorPtr>& detectors)
+{
+  assert((int)detectors.size() == getNumTiles());
+  detectors_ = detectors;
+}
+
+int TiledFeatureDetector::getTileQuota(int n_features, int tile_idx) const
+{
+  int n_tiles = getNumTiles();
+  int quota = n_features / n_tiles;
+  if (tile_idx < n_features % n_tiles) quota++;
+  
+  // detectors need to be asked for at least 1 feature
+  return std::max(quota, 1);
+}
+
+void TiledFeatureDetector::computeTiles(int width, int height)
+{
+  if (!tiles_.empty() && 
+      rois_.back().br() == cv::Point(width, height)) return;
+
+  tiles_.clear();
+  rois_.clear();
+
+  cv::Rect image_rect(0, 0, width, height);
+
+  for (int r = 0; r < rows_; ++r)
+  for (int c = 0; c < cols_; ++c)
+  {
+    int x0 = (c     * width ) / cols_;
+    int x1 = ((c+1) * width ) / cols_;
+    int y0 = (r     * height) / rows_;
+    int y1 = ((r+1) * height) / rows_;
+    
+    cv::Rect tile(x0, y0, x1 - x0, y1 - y0);
+    cv::Rect roi(x0 - overlap_, y0 - overlap_, 
+                 tile.width + 2 * overlap_, tile.height + 2 * overlap_);
+
+    tiles_.push_back(tile);
+    rois_.push_back(roi & image_rect);
+  }
+}
+
+void TiledFeatureDetector::findFeatures(rgbdtools::RGBDFrame& frame)
+{
+  computeTiles(frame.rgb_img.cols, frame.rgb_img.rows);
+
+  frame_ = &frame;
+  pool_->run(getNumTiles(), boost::bind(&TiledFeatureDetector::detectTile, this, _1));
+  frame_ = NULL;
+
+  // **** merge the tile features, keeping only those inside the tile
+
+  frame.keypoints.clear();
+  frame.kp_valid.clear();
+  frame.kp_means.clear();
+  frame.kp_covariances.clear();
+  frame.n_valid_keypoints = 0;
+
+  for (int t_idx = 0; t_idx < getNumTiles(); ++t_idx)
+  {
+    const rgbdtools::RGBDFrame& tile_frame = tile_frames_[t_idx];
+    const cv::Rect& tile = tiles_[t_idx];
+    cv::Point2f offset(rois_[t_idx].x, rois_[t_idx].y);
+
+    for (unsigned int kp_idx = 0; kp_idx < tile_frame.keypoints.size(); ++kp_idx)
+    {
+      cv::KeyPoint kp = tile_frame.keypoints[kp_idx];
+      kp.pt += offset;
+      
+      if (!tile.contains(cv::Point((int)kp.pt.x, (int)kp.pt.y))) continue;
+      
+      bool valid = tile_frame.kp_valid[kp_idx];
+
+      frame.keypoints.push_back(kp);
+      frame.kp_valid.push_back(valid);
+      frame.kp_means.push_back(tile_frame.kp_means[kp_idx]);
+      frame.kp_covariances.push_back(tile_frame.kp_covariances[kp_idx]);
+      
+      if (valid) frame.n_valid_keypoints++;
+    }
+  }
+}
+
+void TiledFeatureDetector::detectTile(int tile_idx)
+{
+  const rgbdtools::RGBDFrame& frame = *frame_;
+  rgbdtools::RGBDFrame& tile_frame = tile_frames_[tile_idx];
+  const cv::Rect& roi = rois_[tile_idx];
+
+  // shift the principal point to the tile origin
+  cv::Mat& intr = intrs_[tile_idx];
+  frame.intr.copyTo(intr);
+  intr.at<double>(0, 2) -= roi.x;
+  intr.at<double>(1, 2) -= roi.y;
+
+  tile_frame.header    = frame.header;
+  tile_frame.index     = frame.index;
+  tile_frame.rgb_img   = frame.rgb_img(roi);
+  tile_frame.depth_img = frame.depth_img(roi);
+  tile_frame.intr      = intr;
+
+  detectors_[tile_idx]->findFeatures(tile_frame);
+}
+
+} // namespace ccny_rgbd
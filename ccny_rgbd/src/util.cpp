@@ -180,6 +180,22 @@ void removeInvalidDistributions(
   }
 }
 
+void transformDistributions(
+  Vector3fVector& means,
+  Matrix3fVector& covariances,
+  const AffineTransform& transform)
+{
+  Matrix3f R = transform.rotation();
+  Matrix3f R_T = R.transpose();
+  
+  unsigned int size = means.size(); 
+  for(unsigned int i = 0; i < size; ++i)
+  {
+    means[i] = transform * means[i];
+    covariances[i] = R * covariances[i] * R_T;
+  }
+}
+
 void tfToEigenRt(
   const tf::Transform& tf, 
   Matrix3f& R, 
@@ -0,0 +1,147 @@
+/**
+ *  @file voxel_grid_accumulator.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "ccny_rgbd/voxel_grid_accumulator.h"
+
+namespace ccny_rgbd {
+
+VoxelGridAccumulator::VoxelGridAccumulator(double leaf_size):
+  leaf_size_(leaf_size)
+{
+
+}
+
+void VoxelGridAccumulator::add(
+  const PointCloudT& cloud, 
+  const AffineTransform& pose, 
+  double max_z)
+{
+  accumulate(cloud, pose, max_z, 1);
+}
+
+void VoxelGridAccumulator::remove(
+  const PointCloudT& cloud, 
+  const AffineTransform& pose, 
+  double max_z)
+{
+  accumulate(cloud, pose, max_z, -1);
+}
+
+void VoxelGridAccumulator::accumulate(
+  const PointCloudT& cloud, 
+  const AffineTransform& pose, 
+  double max_z,
+  int weight)
+{
+  double inv_leaf_size = 1.0 / leaf_size_;
+
+  for (unsigned int pt_idx = 0; pt_idx < cloud.points.size(); ++pt_idx)
+  {
+    const PointT& p = cloud.points[pt_idx];
+    if (std::isnan(p.z)) continue;
+
+    Vector3f q = pose * Vector3f(p.x, p.y, p.z);
+    if (q.z() > max_z) continue;
+
+    VoxelKey key;
+    key.x = floor(q.x() * inv_leaf_size);
+    key.y = floor(q.y() * inv_leaf_size);
+    key.z = floor(q.z() * inv_leaf_size);
+
+    VoxelMap::iterator it = voxels_.find(key);
+    if (it == voxels_.end())
+    {
+      // removing a point which was never added
+      if (weight < 0) continue;
+      
+      Voxel v;
+      v.x = q.x(); v.y = q.y(); v.z = q.z();
+      v.r = p.r;   v.g = p.g;   v.b = p.b;
+      v.n = 1;
+      voxels_.insert(std::make_pair(key, v));
+    }
+    else
+    {
+      Voxel& v = it->second;
+      v.x += weight * q.x(); v.y += weight * q.y(); v.z += weight * q.z();
+      v.r += weight * p.r;   v.g += weight * p.g;   v.b += weight * p.b;
+      v.n += weight;
+      
+      if (v.n <= 0) voxels_.erase(it);
+    }
+  }
+}
+
+void VoxelGridAccumulator::merge(const VoxelGridAccumulator& other)
+{
+  for (VoxelMap::const_iterator it = other.voxels_.begin(); 
+       it != other.voxels_.end(); ++it)
+  {
+    std::pair<VoxelMap::iterator, bool> result = voxels_.insert(*it);
+    if (!result.second)
+    {
+      Voxel& v = result.first->second;
+      const Voxel& o = it->second;
+      v.x += o.x; v.y += o.y; v.z += o.z;
+      v.r += o.r; v.g += o.g; v.b += o.b;
+      v.n += o.n;
+    }
+  }
+}
+
+void VoxelGridAccumulator::swap(VoxelGridAccumulator& other)
+{
+  std::swap(leaf_size_, other.leaf_size_);
+  voxels_.swap(other.voxels_);
+}
+
+void VoxelGridAccumulator::getCloud(PointCloudT& cloud) const
+{
+  cloud.points.clear();
+  cloud.points.reserve(voxels_.size());
+
+  for (VoxelMap::const_iterator it = voxels_.begin(); 
+       it != voxels_.end(); ++it)
+  {
+    const Voxel& v = it->second;
+    double inv_n = 1.0 / v.n;
+
+    PointT p;
+    p.x = v.x * inv_n;
+    p.y = v.y * inv_n;
+    p.z = v.z * inv_n;
+    p.r = v.r * inv_n + 0.5;
+    p.g = v.g * inv_n + 0.5;
+    p.b = v.b * inv_n + 0.5;
+    cloud.points.push_back(p);
+  }
+
+  cloud.width    = cloud.points.size();
+  cloud.height   = 1;
+  cloud.is_dense = true;
+}
+
+} // namespace ccny_rgbd
@@ -0,0 +1,167 @@
+/**
+ *  @file voxel_hash_index.cpp
+ *  @author Ivan Dryanovski <ivan.dryanovski@gmail.com>
+ * 
+ *  @section LICENSE
+ * 
+ *  Copyright (C) 2013, City University of New York
+ *  CCNY Robotics Lab <http://robotics.ccny.cuny.edu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ccny_rgbd/voxel_hash_index.h"
+
+#include <cmath>
+
+namespace ccny_rgbd {
+
+VoxelHashIndex::VoxelHashIndex(double voxel_size):
+  voxel_size_(voxel_size)
+{
+
+}
+
+void VoxelHashIndex::setVoxelSize(double voxel_size)
+{
+  voxel_size_ = voxel_size;
+  clear();
+}
+
+void VoxelHashIndex::clear()
+{
+  voxels_.clear();
+}
+
+VoxelKey VoxelHashIndex::getKey(const Vector3f& point) const
+{
+  VoxelKey key;
+  key.x = (int)std::floor(point(0) / voxel_size_);
+  key.y = (int)std::floor(point(1) / voxel_size_);
+  key.z = (int)std::floor(point(2) / voxel_size_);
+  return key;
+}
+
+void VoxelHashIndex::insert(int idx, const Vector3f& point)
+{
+  voxels_[getKey(point)].push_back(idx);
+}
+
+void VoxelHashIndex::remove(int idx, const Vector3f& point)
+{
+  VoxelMap::iterator it = voxels_.find(getKey(point));
+  if (it == voxels_.end()) return;
+
+  IntVector& cell = it->second;
+  for (unsigned int i = 0; i < cell.size(); ++i)
+  {
+    if (cell[i] == idx)
+    {
+      cell[i] = cell.back();
+      cell.pop_back();
+      break;
+    }
+  }
+
+  if (cell.empty()) voxels_.erase(it);
+}
+
+void VoxelHashIndex::move(
+  int idx, 
+  const Vector3f& old_point, 
+  const Vector3f& new_point)
+{
+  // most updates stay in the same voxel
+  if (getKey(old_point) == getKey(new_point)) return;
+
+  remove(idx, old_point);
+  insert(idx, new_point);
+}
+
+bool VoxelHashIndex::nearest(
+  const Vector3f& query, 
+  const Vector3fVector& points,
+  int& nn_idx, 
+  double& nn_dist_sq) const
+{
+  nn_idx = -1;
+  VoxelKey center = getKey(query);
+
+  VoxelKey key;
+  for (key.x = center.x - 1; key.x <= center.x + 1; ++key.x)
+  for (key.y = center.y - 1; key.y <= center.y + 1; ++key.y)
+  for (key.z = center.z - 1; key.z <= center.z + 1; ++key.z)
+  {
+    VoxelMap::const_iterator it = voxels_.find(key);
+    if (it == voxels_.end()) continue;
+
+    const IntVector& cell = it->second;
+    for (unsigned int i = 0; i < cell.size(); ++i)
+    {
+      double dist_sq = (points[cell[i]] - query).squaredNorm();
+      if (nn_idx < 0 || dist_sq < nn_dist_sq)
+      {
+        nn_idx = cell[i];
+        nn_dist_sq = dist_sq;
+      }
+    }
+  }
+
+  return nn_idx >= 0;
+}
+
+int VoxelHashIndex::nearestK(
+  const Vector3f& query,
+  const Vector3fVector& points,
+  int k,
+  IntVector& indices,
+  FloatVector& dists_sq) const
+{
+  indices.resize(k);
+  dists_sq.resize(k);
+  
+  int n_found = 0;
+  VoxelKey center = getKey(query);
+
+  VoxelKey key;
+  for (key.x = center.x - 1; key.x <= center.x + 1; ++key.x)
+  for (key.y = center.y - 1; key.y <= center.y + 1; ++key.y)
+  for (key.z = center.z - 1; key.z <= center.z + 1; ++key.z)
+  {
+    VoxelMap::const_iterator it = voxels_.find(key);
+    if (it == voxels_.end()) continue;
+
+    const IntVector& cell = it->second;
+    for (unsigned int i = 0; i < cell.size(); ++i)
+    {
+      float dist_sq = (points[cell[i]] - query).squaredNorm();
+      if (n_found == k && dist_sq >= dists_sq[k - 1]) continue;
+
+      // insertion into the sorted neighbor list (k is small)
+      int pos = (n_found < k) ? n_found++ : k - 1;
+      while (pos > 0 && dists_sq[pos - 1] > dist_sq)
+      {
+        indices[pos]  = indices[pos - 1];
+        dists_sq[pos] = dists_sq[pos - 1];
+        --pos;
+      }
+      indices[pos]  = cell[i];
+      dists_sq[pos] = dist_sq;
+    }
+  }
+
+  return n_found;
+}
+
+} // namespace ccny_rgbd